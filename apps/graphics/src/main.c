@@ -55,6 +55,8 @@
 
 #include <sel4test/test.h>
 
+#include <syscall_stats.h>
+
 //--------------------------------------------------------------------
 
 struct env {
@@ -184,7 +186,7 @@ void mapVideoRam(seL4_BootInfo *info) {
 	printf("PAGE_SIZE       = 0x%x = %d\n", PAGE_SIZE, PAGE_SIZE); //4K
 
 	//get numPages of memory so to get hold of VRAM area
-	res = seL4_Untyped_RetypeAtOffset(capUntypedStart,
+	res = SYSCALL_STATS(seL4_Untyped_RetypeAtOffset, capUntypedStart,
 			seL4_IA32_4K, 0, 0,           // type, ,size_bits
 			cnodeCap, 0, 0,               // root, index, depth
 			capPagesStart, numPages);     // offset, num
@@ -192,20 +194,20 @@ void mapVideoRam(seL4_BootInfo *info) {
 
 	//create a page table
 	seL4_Word pt = empty++;
-	res = seL4_Untyped_RetypeAtOffset(memoryCap,
+	res = SYSCALL_STATS(seL4_Untyped_RetypeAtOffset, memoryCap,
 			seL4_IA32_PageTableObject, 0,0,  // type, ,size_bits
 			cnodeCap, 0, 0,                  // root, index, depth
 			pt, 1);                          // offset, num
 	printf("seL4_Untyped_RetypeAtOffset--seL4_IA32_PageTableObject: %x\n", res);
 
 	//map page table to page directory
-	res = seL4_IA32_PageTable_Map(pt, seL4_CapInitThreadPD, vram,
+	res = SYSCALL_STATS(seL4_IA32_PageTable_Map, pt, seL4_CapInitThreadPD, vram,
 			seL4_IA32_Default_VMAttributes);
 	printf("seL4_IA32_PageTable_Map: %x\n", res);
 
 	//map vram pages to page table
 	for (i = 0; i < mumPagesVRam; i++) {
-		res = seL4_IA32_Page_Map(capPagesStart + numPagesToVRam + i,
+		res = SYSCALL_STATS(seL4_IA32_Page_Map, capPagesStart + numPagesToVRam + i,
 				seL4_CapInitThreadPD, vram + PAGE_SIZE * i,
 				seL4_AllRights, seL4_IA32_Default_VMAttributes);
 		printf("seL4_IA32_Page_Map: %x (page %d)\n", res, i);
@@ -249,4 +251,6 @@ int main()
         }
     }
     printf("\n");
+
+    syscall_stats_dump();
 }
@@ -55,6 +55,11 @@
 
 #include <sel4test/test.h>
 
+#ifdef CONFIG_APP_GRAPHICS2_MEMBENCH
+#include <platsupport/arch/tsc.h>
+#include <membench.h>
+#endif
+
 
 //--------------------------------------------------------------------
 
@@ -176,6 +181,54 @@ writeVideoRam(void* vid, seL4_VBEModeInfoBlock* mib) {
 	printf("\n");
 }
 
+#ifdef CONFIG_APP_GRAPHICS2_MEMBENCH
+/* largest buffer to time, the frame buffer may be smaller */
+#define MEMBENCH_MAX_BYTES (1024 * 1024)
+#define MEMBENCH_PASSES 3
+
+static uint64_t
+membenchClock(void* cookie) {
+	return rdtsc_pure();
+}
+
+static void
+membenchMapping(const char* mapping, void* buf, size_t maxBytes) {
+	for (size_t bytes = PAGE_SIZE_4K; bytes <= maxBytes; bytes *= 4) {
+		for (int op = 0; op < MEMBENCH_NUM_OPS; op++) {
+			uint64_t cycles = membench_run(op, buf, bytes, MEMBENCH_PASSES, membenchClock, NULL);
+			size_t units = membench_units(op, bytes);
+			if (op == MEMBENCH_CHASE) {
+				printf("SB& VRAMBENCH mapping=%s op=%s bytes=%u : cycles=%llu loads=%u cycles_per_load=%llu\n",
+						mapping, membench_op_names[op], bytes, cycles, units, cycles / units);
+			} else {
+				printf("SB& VRAMBENCH mapping=%s op=%s bytes=%u : cycles=%llu bytes_per_kcycle=%llu\n",
+						mapping, membench_op_names[op], bytes, cycles,
+						cycles ? (uint64_t) units * 1000 / cycles : 0);
+			}
+		}
+	}
+}
+
+/*
+ * Compare the frame buffer, mapped uncached as device memory, with the
+ * same amount of normal cached memory. This tells us where to stage data
+ * before it goes to the screen.
+ */
+static void
+membenchVideoRam(env_t env, void* vid, seL4_VBEModeInfoBlock* mib) {
+	size_t size = MIN(mib->yRes * mib->linBytesPerScanLine, MEMBENCH_MAX_BYTES);
+	size = ROUND_DOWN(size, PAGE_SIZE_4K);
+
+	void* ram = vspace_new_pages(&env->vspace, seL4_AllRights, size / PAGE_SIZE_4K, seL4_PageBits);
+	assert(ram != NULL);
+
+	membenchMapping("vram", vid, size);
+	membenchMapping("ram", ram, size);
+
+	vspace_unmap_pages(&env->vspace, ram, size / PAGE_SIZE_4K, seL4_PageBits, &env->vka);
+}
+#endif /* CONFIG_APP_GRAPHICS2_MEMBENCH */
+
 static void
 printVBE(seL4_IA32_BootInfo* bootinfo2) {
 	seL4_VBEInfoBlock* ib      = &env.bootinfo2->vbeInfoBlock;
@@ -269,6 +322,10 @@ int main()
 	void* vid = mapVideoRam(&env, mib);
 	printf("frame buffer mapped to vaddr: 0x%x \n", (unsigned int) vid);
 
+#ifdef CONFIG_APP_GRAPHICS2_MEMBENCH
+	membenchVideoRam(&env, vid, mib);
+#endif
+
 	writeVideoRam(vid, mib);
 	printVBE(env.bootinfo2);
 
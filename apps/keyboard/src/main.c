@@ -49,6 +49,10 @@
 
 #include <sel4test/test.h>
 
+#ifdef CONFIG_APP_KEYBOARD_MONITOR
+#include "monitor.h"
+#endif
+
 //--------------------------------------------------------------------
 
 struct env {
@@ -145,6 +149,10 @@ struct conserv_state {
 };
 struct conserv_state conServ;
 
+#ifdef CONFIG_APP_KEYBOARD_MONITOR
+static monitor_t monitor;
+#endif
+
 
 //=============================================================================
 int main(int argc, char *argv[])
@@ -183,6 +191,17 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+#ifdef CONFIG_APP_KEYBOARD_MONITOR
+    /* watch the polling loop below from a monitor thread, which has to
+     * run above us */
+    monitor_init(&monitor);
+    monitor_add(&monitor, "keyboard", seL4_CapInitThreadTCB, seL4_MaxPrio - 1);
+    int error = monitor_start(&monitor, &env.vka, &env.vspace, &env.simple, seL4_MaxPrio);
+    assert(error == 0);
+    error = seL4_TCB_SetPriority(seL4_CapInitThreadTCB, seL4_MaxPrio - 1);
+    assert(error == 0);
+#endif
+
     //read from keyboard
     for(;;) {
         int c = ps_cdev_getchar(&conServ.devKeyboard);
@@ -16,9 +16,12 @@
 #include <platsupport/chardev.h>
 #include <sel4platsupport/platsupport.h>
 #include <sel4platsupport/timer.h>
+#include <sel4platsupport/plat/timer.h>
+#include <platsupport/timer.h>
 #include <sel4platsupport/arch/io.h>
 #include <sel4utils/vspace.h>
 #include <vka/object_capops.h>
+#include <utils/time.h>
 
 #ifdef CONFIG_KERNEL_STABLE
 #include <simple-stable/simple-stable.h>
@@ -117,6 +120,10 @@ static sel4utils_alloc_data_t allocData;
 /* platsupport IO */
 static struct ps_io_ops opsIO;
 
+// TSC timer, to bound the time spent bringing up the keyboard
+static seL4_timer_t *clock_timer;
+static vka_object_t clock_aep;
+
 
 // ======================================================================
 
@@ -166,6 +173,25 @@ setup_system()
 }
 
 
+static uint64_t
+clock_now_ns()
+{
+    return timer_get_time(clock_timer->timer);
+}
+
+// the default timer is only needed to calibrate the TSC
+static void
+init_clock()
+{
+    UNUSED int err = vka_alloc_async_endpoint(&vka, &clock_aep);
+    assert(err == 0);
+    seL4_timer_t *timer = sel4platsupport_get_default_timer(&vka, &vspace, &simple, clock_aep.cptr);
+    assert(timer != NULL);
+    clock_timer = sel4platsupport_get_tsc_timer(timer);
+    assert(clock_timer != NULL);
+}
+
+
 // creates IRQHandler cap "handler" for IRQ "irq"
 static void
 get_irqhandler_cap(int irq, cspacepath_t* handler)
@@ -205,7 +231,7 @@ flush_keyboard(struct ps_chardevice *device);
 
 static void
 init_keyboard(chardev_t* dev) {
-    int n = 0;
+    uint64_t start = clock_now_ns();
     ps_chardevice_t *ret;
     do {
         //ps_cdev_init() tries to set the keyboard to "scan code set 2"
@@ -216,8 +242,10 @@ init_keyboard(chardev_t* dev) {
         // The code to initialize the keyboard in platsupport
         // does not return PS2_CONTROLLER_SELF_TEST_OK when a key is pressed
         // before or during initialization or something?
-        if (n++ == 100) {
-            // We retry a couple of times before giving up.
+        // We retry for a while before giving up. A single try is
+        // not bounded, as ps_cdev_init() is in platsupport.
+        if (ret == NULL && clock_now_ns() - start >
+                (uint64_t) CONFIG_APP_KEYBOARD3_INIT_TIMEOUT_MS * NS_IN_MS) {
             printf("Failed to initialize PS2 keyboard.\n");
             exit(EXIT_FAILURE);
         }
@@ -419,6 +447,8 @@ int main()
 
     printf("\n\n>>>>>>>>>> keyboard3 <<<<<<<<<< \n\n");
 
+    init_clock();
+
     chardev_t keyboard;
     init_keyboard(&keyboard);
 
@@ -13,10 +13,73 @@
 #include <string.h>
 #include <sel4/sel4.h>
 #include <assert.h>
+#include <trace.h>
 
 static struct keyboard_state kb_state;
 static keycode_state_t kc_state;
 
+#ifdef CONFIG_APP_KEYBOARD4_IRQ
+/* IRQ mode: the IRQ thread owns the controller and pushes the key events
+   it decodes, readers pop them. */
+static keyboard_ring_t kb_ring;
+/* readers wait on this when the ring is empty */
+static seL4_CPtr kb_event_aep;
+/* the IRQ thread's AEP, to wake it when the ring stops being full or the
+   LEDs need setting */
+static seL4_CPtr kb_irq_aep;
+static bool kb_led_pending;
+
+void
+keyboard_cdev_irq_mode(seL4_CPtr event_aep, seL4_CPtr irq_aep)
+{
+    kb_event_aep = event_aep;
+    kb_irq_aep = irq_aep;
+}
+
+bool
+keyboard_cdev_drain(void)
+{
+    if (__atomic_exchange_n(&kb_led_pending, false, __ATOMIC_ACQUIRE)) {
+        keyboard_set_led(&kb_state, kc_state.scroll_lock, kc_state.num_lock, kc_state.caps_lock);
+    }
+
+    while (keyboard_ps2_has_output(&kb_state)) {
+        if (keyboard_ring_full(&kb_ring)) {
+            /* Leave the rest in the controller, which holds off the
+               keyboard, until the reader makes room. */
+            return false;
+        }
+        keyboard_key_event_t ev = keyboard_poll_ps2_keyevent(&kb_state);
+        if (ev.vkey != -1 && keyboard_ring_push(&kb_ring, ev) == 1) {
+            seL4_Notify(kb_event_aep, 1);
+        }
+    }
+    return true;
+}
+#endif /* CONFIG_APP_KEYBOARD4_IRQ */
+
+/* The next key event: in IRQ mode wait for one, otherwise poll the
+   controller (vkey is -1 if there is none). */
+static keyboard_key_event_t
+keyboard_next_keyevent(void)
+{
+#ifdef CONFIG_APP_KEYBOARD4_IRQ
+    if (kb_event_aep != seL4_CapNull) {
+        keyboard_key_event_t ev;
+        int was_full;
+        /* only block when there is nothing to read */
+        while ((was_full = keyboard_ring_pop(&kb_ring, &ev)) < 0) {
+            seL4_Wait(kb_event_aep, NULL);
+        }
+        if (was_full) {
+            seL4_Notify(kb_irq_aep, 1);
+        }
+        return ev;
+    }
+#endif
+    return keyboard_poll_ps2_keyevent(&kb_state);
+}
+
 //jm--
 void
 keyboard_set_scanset(int scanset) {
@@ -29,17 +92,32 @@ keyboard_poll_keyevent(int16_t* vkey)
 {
     const char* keycode_vkey_desc(uint16_t vk);
 
-    int em1 = kb_state.state & KEYBOARD_PS2_STATE_EXTENDED_MODE;
-    int re1 = kb_state.state & KEYBOARD_PS2_STATE_RELEASE_KEY;
+    UNUSED int em1 = kb_state.state & KEYBOARD_PS2_STATE_EXTENDED_MODE;
+    UNUSED int re1 = kb_state.state & KEYBOARD_PS2_STATE_RELEASE_KEY;
 
-    keyboard_key_event_t ev = keyboard_poll_ps2_keyevent(&kb_state);
-    int em2 = kb_state.state & KEYBOARD_PS2_STATE_EXTENDED_MODE;
-    int re2 = kb_state.state & KEYBOARD_PS2_STATE_RELEASE_KEY;
+    keyboard_key_event_t ev = keyboard_next_keyevent();
+    UNUSED int em2 = kb_state.state & KEYBOARD_PS2_STATE_EXTENDED_MODE;
+    UNUSED int re2 = kb_state.state & KEYBOARD_PS2_STATE_RELEASE_KEY;
 
     if (ev.vkey != -1) {
+#ifdef CONFIG_APP_SHARED_TRACE
+        // a printf here takes longer than the key event; trace it instead,
+        // in two records as each takes at most four arguments
+        TRACE("key %s: %s vkey=%d=0x%x", ev.pressed ? "DOWN":"UP  ",
+                keycode_vkey_desc(ev.vkey), ev.vkey, ev.vkey);
+#ifndef CONFIG_APP_KEYBOARD4_IRQ
+        // in IRQ mode the state belongs to the IRQ thread, and has moved on
+        TRACE("    extmode1=%d extmode2=%d release1=%d release2=%d",
+                (em1 > 0), (em2 > 0), (re1 > 0), (re2 > 0));
+#endif
+#elif defined(CONFIG_APP_KEYBOARD4_IRQ)
+        printf("key %s: %s vkey=%d=0x%x\n", ev.pressed ? "DOWN":"UP  ",
+                keycode_vkey_desc(ev.vkey), ev.vkey, ev.vkey);
+#else
         printf("key %s: %s extmode1=%d extmode2=%d release1=%d release2=%d vkey=%d=0x%x\n",
                 ev.pressed ? "DOWN":"UP  ", keycode_vkey_desc(ev.vkey),
                 (em1 > 0), (em2 > 0), (re1 > 0), (re2 > 0), ev.vkey, ev.vkey);
+#endif
     }
     *vkey = ev.vkey;
     return ev.pressed;
@@ -48,6 +126,15 @@ keyboard_poll_keyevent(int16_t* vkey)
 void
 keyboard_cdev_handle_led_changed(void *cookie)
 {
+#ifdef CONFIG_APP_KEYBOARD4_IRQ
+    if (kb_irq_aep != seL4_CapNull) {
+        /* only the IRQ thread may talk to the controller */
+        kc_state.led_state_changed = false;
+        __atomic_store_n(&kb_led_pending, true, __ATOMIC_RELEASE);
+        seL4_Notify(kb_irq_aep, 1);
+        return;
+    }
+#endif
     /* Update LED states. */
     keyboard_set_led(&kb_state, kc_state.scroll_lock, kc_state.num_lock, kc_state.caps_lock);
     kc_state.led_state_changed = false;
@@ -56,7 +143,7 @@ keyboard_cdev_handle_led_changed(void *cookie)
 static int
 keyboard_getchar(struct ps_chardevice *device)
 {
-    keyboard_key_event_t ev = keyboard_poll_ps2_keyevent(&kb_state);
+    keyboard_key_event_t ev = keyboard_next_keyevent();
     return keycode_process_vkey_event_to_char(&kc_state, ev.vkey, ev.pressed, NULL);
 }
 
@@ -11,9 +11,12 @@
 #ifndef _PLATSUPPORT_PLAT_KEYBOARD_PS2_CHARDEV_H
 #define _PLATSUPPORT_PLAT_KEYBOARD_PS2_CHARDEV_H
 
+#include <autoconf.h>
+#include <sel4/sel4.h>
 #include "chardev.h"
 #include "keyboard_ps2.h"
 #include "keyboard_vkey.h"
+#include "keyboard_ring.h"
 
 void
 keyboard_set_scanset(int scanset);
@@ -24,4 +27,18 @@ keyboard_poll_keyevent(int16_t* vkey);
 int
 keyboard_cdev_init(const struct dev_defn* defn, const ps_io_ops_t* ops, ps_chardevice_t* dev);
 
+#ifdef CONFIG_APP_KEYBOARD4_IRQ
+/* Switch to IRQ mode once the keyboard is set up: from then on only the IRQ thread, which
+   waits on irq_aep, may touch the controller, and calls keyboard_cdev_drain on every IRQ
+   and every time it is woken. Readers of key events and chars block on event_aep while
+   there are none. */
+void
+keyboard_cdev_irq_mode(seL4_CPtr event_aep, seL4_CPtr irq_aep);
+
+/* Move key events from the controller to the ring until the controller is empty (returns
+   true, the IRQ can be acked) or the ring is full (returns false). */
+bool
+keyboard_cdev_drain(void);
+#endif
+
 #endif /* _PLATSUPPORT_PLAT_KEYBOARD_PS2_CHARDEV_H */
@@ -14,15 +14,37 @@
 #include <string.h>
 #include <sel4/sel4.h>
 #include <assert.h>
-
-static double
-ps2_delay(int n) {
-    printf("ps2_delay %d\n", n);
-    double d = 200.0 + n;
-    for (int i = 0; i < n; i++) {
-        d = d + 10 * d/3.2;
+#include <utils/time.h>
+#include <syscall_stats.h>
+
+/* Bounds on the waits for the controller and the keyboard, in microseconds
+   of the clock set with keyboard_set_clock. */
+#define PS2_CONTROLLER_TIMEOUT_US       50000
+#define PS2_SELF_TEST_TIMEOUT_US        500000
+#define PS2_KEYBOARD_TIMEOUT_US         100000
+/* the keyboard's own self test after a reset takes up to about 750ms */
+#define PS2_BAT_TIMEOUT_US              1000000
+#define PS2_KEYBOARD_TRIES              3
+#define PS2_COMMAND_BYTE_TRIES          4
+
+/* called while waiting for the controller, see keyboard_set_wait_output */
+static void (*ps2_wait_output)(void *cookie);
+static void *ps2_wait_output_cookie;
+
+/* wall clock for the timeouts, see keyboard_set_clock */
+static uint64_t (*ps2_clock)(void *cookie);
+static void *ps2_clock_cookie;
+/* status reads so far, the clock if there is no other */
+static uint64_t ps2_polls;
+
+static uint64_t
+ps2_now_us(void)
+{
+    if (ps2_clock) {
+        return ps2_clock(ps2_clock_cookie) / NS_IN_US;
     }
-    return d;
+    /* a read from an ISA I/O port takes about a microsecond */
+    return ps2_polls;
 }
 
 static void
@@ -42,9 +64,10 @@ static uint8_t
 ps2_read_control_status(ps_io_ops_t *ops)
 {
     uint32_t res = 0;
-    int error = ps_io_port_in(&ops->io_port_ops, PS2_IOPORT_CONTROL, 1, &res);
+    int error = SYSCALL_STATS(ps_io_port_in, &ops->io_port_ops, PS2_IOPORT_CONTROL, 1, &res);
     assert(!error);
     (void) error;
+    ps2_polls++;
     return (uint8_t) res;
 }
 
@@ -52,72 +75,124 @@ static uint8_t
 ps2_read_data(ps_io_ops_t *ops)
 {
     uint32_t res = 0;
-    int error = ps_io_port_in(&ops->io_port_ops, PS2_IOPORT_DATA, 1, &res);
+    int error = SYSCALL_STATS(ps_io_port_in, &ops->io_port_ops, PS2_IOPORT_DATA, 1, &res);
     assert(!error);
     (void) error;
     return (uint8_t) res;
 }
 
-static void
+/* Wait for the controller to take the last byte written to it */
+static int
+ps2_wait_input_empty(ps_io_ops_t *ops)
+{
+    uint64_t start = ps2_now_us();
+    while ( (ps2_read_control_status(ops) & 0x2) != 0) {
+        if (ps2_now_us() - start >= PS2_CONTROLLER_TIMEOUT_US) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
 ps2_write_output(ps_io_ops_t *ops, uint8_t byte)
 {
-    while ( (ps2_read_control_status(ops) & 0x2) != 0);
+    if (ps2_wait_input_empty(ops)) {
+        return -1;
+    }
     ps_io_port_out(&ops->io_port_ops, PS2_IOPORT_DATA, 1, byte);
+    return 0;
+}
+
+/* Read a byte from the controller, waiting at most timeout_us for it, or
+ * for ever if timeout_us is 0. A wait hook that blocks only has the
+ * timeout checked when it returns. */
+static int
+ps2_read_output_timeout(ps_io_ops_t *ops, uint32_t timeout_us, uint8_t *byte)
+{
+    uint64_t start = ps2_now_us();
+    while ( (ps2_read_control_status(ops) & 0x1) == 0) {
+        if (timeout_us && ps2_now_us() - start >= timeout_us) {
+            return -1;
+        }
+        if (ps2_wait_output) {
+            ps2_wait_output(ps2_wait_output_cookie);
+        }
+    }
+    *byte = ps2_read_data(ops);
+    return 0;
 }
 
 static uint8_t
 ps2_read_output(ps_io_ops_t *ops)
 {
-    while ( (ps2_read_control_status(ops) & 0x1) == 0);
-    return ps2_read_data(ops);
+    uint8_t byte = 0;
+    ps2_read_output_timeout(ops, 0, &byte);
+    return byte;
 }
 
-static void
-ps2_send_keyboard_cmd(ps_io_ops_t *ops, uint8_t cmd)
+/* Send a command (with a parameter byte, unless param is negative) to the
+ * keyboard until it acks it. Each try waits at most PS2_KEYBOARD_TIMEOUT_US
+ * for the reply. */
+static int
+ps2_send_keyboard_cmd_param(ps_io_ops_t *ops, uint8_t cmd, int param)
 {
-    do {
-        ps2_write_output(ops, cmd);
-    } while (ps2_read_output(ops) != KEYBOARD_ACK);
+    for (int i = 0; i < PS2_KEYBOARD_TRIES; i++) {
+        uint8_t res;
+        if (ps2_write_output(ops, cmd)) {
+            return -1;
+        }
+        if (param >= 0 && ps2_write_output(ops, param)) {
+            return -1;
+        }
+        if (ps2_read_output_timeout(ops, PS2_KEYBOARD_TIMEOUT_US, &res) == 0 &&
+                res == KEYBOARD_ACK) {
+            return 0;
+        }
+    }
+    return -1;
 }
 
-static void
-ps2_send_keyboard_cmd_param(ps_io_ops_t *ops, uint8_t cmd, uint8_t param)
+static int
+ps2_send_keyboard_cmd(ps_io_ops_t *ops, uint8_t cmd)
 {
-    do {
-        ps2_write_output(ops, cmd);
-        ps2_write_output(ops, param);
-    } while (ps2_read_output(ops) != KEYBOARD_ACK);
+    return ps2_send_keyboard_cmd_param(ops, cmd, -1);
 }
 
 //jm--
-static void
+/* Enable IRQs and disable translation (IRQ bits 0, 1, translation 6) in the
+ * command byte. Some controllers need a second go before it sticks. */
+static int
 ps_init_commandbyte(ps_io_ops_t *ops) {
-    int i = 0;
-    int8_t config;
-    int8_t config2;
+    uint8_t config;
+    uint8_t config2;
 
     /* Read command byte: current value is placed in port 60h. */
     ps2_single_control(ops, PS2_READ_CMD_BYTE);
-    config = ps2_read_output(ops);
-    printf("bCR=%x ", config);
-    /* Enable IRQs and disable translation (IRQ bits 0, 1, translation 6). */
+    if (ps2_read_output_timeout(ops, PS2_CONTROLLER_TIMEOUT_US, &config)) {
+        return -1;
+    }
     config |= 0x1;
     config &= 0xBF;
-    do {
+
+    for (int i = 0; i < PS2_COMMAND_BYTE_TRIES; i++) {
         /* Write command byte: next byte written to port 60h is
            placed in command register. */
         ps2_single_control(ops, PS2_WRITE_CMD_BYTE);
-        ps2_delay(1 << i);
-        ps2_write_output(ops, config);
+        if (ps2_write_output(ops, config) || ps2_wait_input_empty(ops)) {
+            return -1;
+        }
         //re-read
-        ps2_delay(1 << i);
         ps2_single_control(ops, PS2_READ_CMD_BYTE);
-        config2 = ps2_read_output(ops);
-        printf("aCR=%x/%d ", config2, i);
-        fflush(stdout);
-    } while (config2 != config && i++ < 24);
-    printf("ps_init_commandbyte() - done ");
-    fflush(stdout);
+        if (ps2_read_output_timeout(ops, PS2_CONTROLLER_TIMEOUT_US, &config2)) {
+            return -1;
+        }
+        if (config2 == config) {
+            return 0;
+        }
+    }
+    printf("ps_init_commandbyte() wrote %x, reads %x\n", config, config2);
+    return -1;
 }
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -201,6 +276,88 @@ keyboard_state_push_ps2_keyevent(struct keyboard_state *s, uint16_t ps2_keyevent
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* The steps of keyboard_init. Every wait in them is bounded, so each step
+   completes or fails within a bounded wall time. */
+enum ps2_init_step {
+    PS2_INIT_DISABLE,
+    PS2_INIT_SELF_TEST,
+    PS2_INIT_COMMAND_BYTE,
+    PS2_INIT_INTERFACE_TEST,
+    PS2_INIT_ENABLE,
+    PS2_INIT_RESET,
+    PS2_INIT_SCANMODE,
+    PS2_INIT_DONE
+};
+
+static const char *ps2_init_step_names[] = {
+    [PS2_INIT_DISABLE]        = "disable",
+    [PS2_INIT_SELF_TEST]      = "controller self test",
+    [PS2_INIT_COMMAND_BYTE]   = "command byte",
+    [PS2_INIT_INTERFACE_TEST] = "keyboard interface test",
+    [PS2_INIT_ENABLE]         = "enable",
+    [PS2_INIT_RESET]          = "keyboard reset",
+    [PS2_INIT_SCANMODE]       = "scan mode",
+};
+
+static int
+ps2_init_step(struct keyboard_state *state, int step)
+{
+    uint8_t res;
+
+    switch (step) {
+    case PS2_INIT_DISABLE:
+        /* Disable both PS2 devices. */
+        ps2_single_control(&state->ops, PS2_CMD_DISABLE_KEYBOARD_INTERFACE);
+        ps2_single_control(&state->ops, PS2_CMD_DISABLE_MOUSE_INTERFACE);
+        /* Flush the output buffer. */
+        ps2_read_data(&state->ops);
+        return 0;
+
+    case PS2_INIT_SELF_TEST:
+        /* Run a controller self test. Weird, I have to do the self test
+         * first because it clobbers my command byte.
+         */
+        ps2_single_control(&state->ops, PS2_CMD_CONTROLLER_SELF_TEST);
+        if (ps2_read_output_timeout(&state->ops, PS2_SELF_TEST_TIMEOUT_US, &res)) {
+            return -1;
+        }
+        return res == PS2_CONTROLLER_SELF_TEST_OK ? 0 : -1;
+
+    case PS2_INIT_COMMAND_BYTE:
+        return ps_init_commandbyte(&state->ops);
+
+    case PS2_INIT_INTERFACE_TEST:
+        /* Run keyboard interface test. */
+        ps2_single_control(&state->ops, PS2_CMD_KEYBOARD_INTERFACE_TEST);
+        if (ps2_read_output_timeout(&state->ops, PS2_CONTROLLER_TIMEOUT_US, &res)) {
+            return -1;
+        }
+        return res == 0 ? 0 : -1;
+
+    case PS2_INIT_ENABLE:
+        /* Enable keyboard interface. */
+        ps2_single_control(&state->ops, PS2_CMD_ENABLE_KEYBOARD_INTERFACE);
+        ps2_read_data(&state->ops);
+        return 0;
+
+    case PS2_INIT_RESET:
+        /* Reset the keyboard device. */
+        return keyboard_reset(state);
+
+    case PS2_INIT_SCANMODE:
+        /* Set scanmode 2. */
+        return keyboard_set_scanmode(state, 2);
+    }
+    return -1;
+}
+
+void
+keyboard_set_wait_output(void (*wait)(void *cookie), void *cookie)
+{
+    ps2_wait_output = wait;
+    ps2_wait_output_cookie = cookie;
+}
+
 int
 keyboard_init(struct keyboard_state *state, const ps_io_ops_t* ops,
               void (*handle_event_callback)(keyboard_key_event_t ev, void *cookie))
@@ -213,51 +370,24 @@ keyboard_init(struct keyboard_state *state, const ps_io_ops_t* ops,
     state->scanset = 2;
     state->handle_event_callback = handle_event_callback;
 
-    /* Initialise the PS2 keyboard device. */
-
-    /* Disable both PS2 devices. */
-    ps2_single_control(&state->ops, PS2_CMD_DISABLE_KEYBOARD_INTERFACE);
-    ps2_single_control(&state->ops, PS2_CMD_DISABLE_MOUSE_INTERFACE);
-
-    /* Flush the output buffer. */
-    ps2_read_data(&state->ops);
-
-    /* Run a controller self test. Weird, I have to do the self test
-     * first because it clobbers my command byte.
-     */
-    ps2_single_control(&state->ops, PS2_CMD_CONTROLLER_SELF_TEST);
-    uint8_t res = ps2_read_output(&state->ops);
-    if (res != PS2_CONTROLLER_SELF_TEST_OK) {
-        return -1;
-    }
-
-    /* Enable IRQs and disable translation (IRQ bits 0, 1, translation 6). */
-    ps_init_commandbyte(&state->ops);
-
-    /* Run keyboard interface test. */
-    ps2_single_control(&state->ops, PS2_CMD_KEYBOARD_INTERFACE_TEST);
-    res = ps2_read_output(&state->ops);
-    if (res != 0) {
-        return -1;
-    }
-
-    /* Enable keyboard interface. */
-    ps2_single_control(&state->ops, PS2_CMD_ENABLE_KEYBOARD_INTERFACE);
-    ps2_read_data(&state->ops);
-
-    /* Reset the keyboard device. */
-    if (keyboard_reset(state)) {
-        return -1;
+    uint64_t start = ps2_now_us();
+    for (int step = 0; step < PS2_INIT_DONE; step++) {
+        if (ps2_init_step(state, step)) {
+            printf("keyboard_init() %s failed after %llu us\n", ps2_init_step_names[step],
+                   (unsigned long long) (ps2_now_us() - start));
+            return -1;
+        }
     }
-
-    /* Set scanmode 2. */
-    keyboard_set_scanmode(state, 2);
-
-    /* there may be some ACKs in the buffer */
-    //keyboard_flush(&state->ops);
     return 0;
 }
 
+void
+keyboard_set_clock(uint64_t (*now_ns)(void *cookie), void *cookie)
+{
+    ps2_clock = now_ns;
+    ps2_clock_cookie = cookie;
+}
+
 void
 keyboard_set_led(struct keyboard_state *state, char scroll_lock, char num_lock, char caps_lock)
 {
@@ -265,28 +395,38 @@ keyboard_set_led(struct keyboard_state *state, char scroll_lock, char num_lock,
                                 scroll_lock | num_lock << 1 | caps_lock << 2);
 }
 
-void
+int
 keyboard_set_scanmode(struct keyboard_state *state, uint8_t mode)
 {
-    ps2_send_keyboard_cmd(&state->ops, KEYBOARD_DISABLE_SCAN); /* Disable scanning. */
-    ps2_send_keyboard_cmd_param(&state->ops, KEYBOARD_SET_SCANCODE_MODE, mode); /* Set scan code. */
-    ps2_send_keyboard_cmd(&state->ops, KEYBOARD_ENABLE_SCAN); /* Re-Enable scanning. */
+    if (ps2_send_keyboard_cmd(&state->ops, KEYBOARD_DISABLE_SCAN) || /* Disable scanning. */
+            ps2_send_keyboard_cmd_param(&state->ops, KEYBOARD_SET_SCANCODE_MODE, mode) || /* Set scan code. */
+            ps2_send_keyboard_cmd(&state->ops, KEYBOARD_ENABLE_SCAN)) { /* Re-Enable scanning. */
+        return -1;
+    }
+    return 0;
 }
 
 int
 keyboard_reset(struct keyboard_state *state)
 {
     /* Reset the keyboard device. */
-    ps2_send_keyboard_cmd(&state->ops, KEYBOARD_RESET);
+    if (ps2_send_keyboard_cmd(&state->ops, KEYBOARD_RESET)) {
+        return -1;
+    }
 
     /* Wait for the Basic Assurance Test. */
-    while (1) {
-        uint8_t res = ps2_read_output(&state->ops);
+    uint64_t start = ps2_now_us();
+    for (;;) {
+        uint64_t waited = ps2_now_us() - start;
+        uint8_t res;
+        if (waited >= PS2_BAT_TIMEOUT_US ||
+                ps2_read_output_timeout(&state->ops, PS2_BAT_TIMEOUT_US - waited, &res)) {
+            return -1;
+        }
         if (res == KEYBOARD_BAT_SUCCESSFUL) {
             break;
         }
         if (res == KEYBOARD_ERROR) {
-            assert(!"keyboard init keyboard BAT failed.");
             return -1;
         }
     }
@@ -294,6 +434,12 @@ keyboard_reset(struct keyboard_state *state)
     return 0;
 }
 
+bool
+keyboard_ps2_has_output(struct keyboard_state *state)
+{
+    return (ps2_read_control_status(&state->ops) & 0x1) != 0;
+}
+
 keyboard_key_event_t
 keyboard_poll_ps2_keyevent(struct keyboard_state *state)
 {
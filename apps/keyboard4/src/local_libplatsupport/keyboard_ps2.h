@@ -73,21 +73,37 @@ struct keyboard_state {
 
 
 void keyboard_flush(ps_io_ops_t *ops);
+
+/* Call wait(cookie) instead of spinning while waiting for the keyboard to send a byte (the
+   reply to a command), for example to block until its IRQ. NULL, the default, spins. The
+   status is checked again after every call, so wait may return early. */
+void keyboard_set_wait_output(void (*wait)(void *cookie), void *cookie);
+
+/* Use now_ns(cookie), a wall clock in nanoseconds, for the timeouts of the commands sent to the
+   controller and keyboard. Without one, each read of the controller status counts as a
+   microsecond. */
+void keyboard_set_clock(uint64_t (*now_ns)(void *cookie), void *cookie);
 int keyboard_detect_scanset(ps_io_ops_t *ops);
 
 /* Initialise keyboard driver state.
    The handle_event_callback parameter is optional, and may be set to NULL. Events are be
    returned by keyboard_poll_ps2_keyevents().
+   Every step of the initialisation has a timeout, so this fails (returns -1, naming the step
+   that failed) within a bounded time rather than waiting for ever on a controller or keyboard
+   that does not answer.
 */
 int keyboard_init(struct keyboard_state *state, const ps_io_ops_t* ops,
                   void (*handle_event_callback)(keyboard_key_event_t ev, void *cookie));
 
-void keyboard_set_scanmode(struct keyboard_state *state, uint8_t mode);
+int keyboard_set_scanmode(struct keyboard_state *state, uint8_t mode);
 
 void keyboard_set_led(struct keyboard_state *state, char scroll_lock, char num_lock, char caps_lock);
 
 int keyboard_reset(struct keyboard_state *state);
 
+/* Does the controller have a byte from the keyboard? */
+bool keyboard_ps2_has_output(struct keyboard_state *state);
+
 /* This may be called in a loop on every IRQ, until no more character events reported.
    Note that this polling will NOT call the handle_event_callback on key events. */
 keyboard_key_event_t keyboard_poll_ps2_keyevent(struct keyboard_state *state);
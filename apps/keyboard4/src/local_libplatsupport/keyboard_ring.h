@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2015, Josef Mihalits
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *
+ */
+
+#ifndef _PLATSUPPORT_PLAT_KEYBOARD_RING_H
+#define _PLATSUPPORT_PLAT_KEYBOARD_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "keyboard_ps2.h"
+
+/* Single producer, single consumer ring of key events, without locks: the
+   IRQ thread pushes what it decodes, one other thread pops. Each index is
+   only written by its own side; the release store of an index publishes
+   the slot it covers, and the acquire load on the other side sees it.
+
+   Push and pop report the transitions the other side may be blocked on
+   (empty to non-empty, full to not full), so that it only needs to be
+   notified then. */
+
+/* a power of two */
+#define KEYBOARD_RING_SIZE 64
+
+typedef struct keyboard_ring {
+    /* events ever pushed (written by the producer), and popped (consumer) */
+    uint32_t head;
+    uint32_t tail;
+    keyboard_key_event_t events[KEYBOARD_RING_SIZE];
+} keyboard_ring_t;
+
+static inline bool
+keyboard_ring_empty(keyboard_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline bool
+keyboard_ring_full(keyboard_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == KEYBOARD_RING_SIZE;
+}
+
+/* Producer only. Returns -1 if the ring is full, otherwise 1 if it was
+   empty before, and 0 if not. */
+static inline int
+keyboard_ring_push(keyboard_ring_t *ring, keyboard_key_event_t ev)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == KEYBOARD_RING_SIZE) {
+        return -1;
+    }
+    ring->events[head & (KEYBOARD_RING_SIZE - 1)] = ev;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return head == tail;
+}
+
+/* Consumer only. Returns -1 if the ring is empty, otherwise 1 if it was
+   full before, and 0 if not. */
+static inline int
+keyboard_ring_pop(keyboard_ring_t *ring, keyboard_key_event_t *ev)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return -1;
+    }
+    *ev = ring->events[tail & (KEYBOARD_RING_SIZE - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return head - tail == KEYBOARD_RING_SIZE;
+}
+
+#endif /* _PLATSUPPORT_PLAT_KEYBOARD_RING_H */
@@ -16,9 +16,15 @@
 #include <platsupport/chardev.h>
 #include <sel4platsupport/platsupport.h>
 #include <sel4platsupport/timer.h>
+#include <sel4platsupport/plat/timer.h>
+#include <platsupport/timer.h>
 #include <sel4platsupport/arch/io.h>
 #include <sel4utils/vspace.h>
+#include <sel4utils/thread.h>
 #include <vka/object_capops.h>
+#include <utils/time.h>
+#include <syscall_stats.h>
+#include <trace.h>
 
 #ifdef CONFIG_KERNEL_STABLE
 #include <simple-stable/simple-stable.h>
@@ -62,6 +68,10 @@ static sel4utils_alloc_data_t allocData;
 /* platsupport IO */
 static struct ps_io_ops opsIO;
 
+/* TSC timer, the clock for the timeouts of the keyboard driver */
+static seL4_timer_t *clock_timer;
+static vka_object_t clock_aep;
+
 
 // ======================================================================
 
@@ -111,6 +121,27 @@ setup_system()
 }
 
 
+static uint64_t
+clock_now_ns(void *cookie UNUSED)
+{
+    return timer_get_time(clock_timer->timer);
+}
+
+// the default timer is only needed to calibrate the TSC
+static void
+init_clock()
+{
+    UNUSED int err = vka_alloc_async_endpoint(&vka, &clock_aep);
+    assert(err == 0);
+    seL4_timer_t *timer = sel4platsupport_get_default_timer(&vka, &vspace, &simple, clock_aep.cptr);
+    assert(timer != NULL);
+    clock_timer = sel4platsupport_get_tsc_timer(timer);
+    assert(clock_timer != NULL);
+
+    keyboard_set_clock(clock_now_ns, NULL);
+}
+
+
 // creates IRQHandler cap "handler" for IRQ "irq"
 static void
 get_irqhandler_cap(int irq, cspacepath_t* handler)
@@ -143,17 +174,18 @@ static const struct dev_defn my_keyboard_def = {
 
 static void
 init_keyboard(chardev_t* dev) {
-    int n = 0;
     int err = 0;
+    uint64_t start = clock_now_ns(NULL);
     do {
         //ret = ps_cdev_init(PC99_KEYBOARD_PS2, &opsIO, &dev->dev);
         err = keyboard_cdev_init(&my_keyboard_def, &opsIO, &dev->dev);
-        if (n++ == 100) {
-            // We retry a couple of times before giving up.
+        if (err && clock_now_ns(NULL) - start > (uint64_t) CONFIG_APP_KEYBOARD4_INIT_TIMEOUT_MS * NS_IN_MS) {
+            // We retry for a while before giving up; every try is bounded.
             printf("Failed to initialize PS2 keyboard.\n");
             exit(EXIT_FAILURE);
         }
     } while (err);
+    printf("keyboard up after %llu ms\n", (unsigned long long) ((clock_now_ns(NULL) - start) / NS_IN_MS));
 
     // Loop through all IRQs and get the one device needs to listen to
     // We currently assume there it only needs one IRQ.
@@ -186,6 +218,60 @@ init_keyboard(chardev_t* dev) {
 }
 
 
+#ifdef CONFIG_APP_KEYBOARD4_IRQ
+/* IRQ thread of the keyboard, and the AEP readers block on for key events */
+static sel4utils_thread_t irq_thread;
+static vka_object_t event_aep;
+
+/* Wait for the keyboard to send a byte, in the IRQ thread */
+static void
+wait_keyboard_irq(void *cookie)
+{
+    chardev_t* dev = cookie;
+    UNUSED int err = seL4_IRQHandler_Ack(dev->handler.capPtr);
+    assert(err == 0);
+    seL4_Wait(dev->ep.cptr, NULL);
+}
+
+/* Drain the controller on every IRQ, and whenever a reader makes room in
+ * the full event ring (it notifies the same AEP). */
+static void
+keyboard_irq_thread(void *arg0, void *arg1 UNUSED, void *ipc_buf UNUSED)
+{
+    chardev_t* dev = arg0;
+    for (;;) {
+        if (keyboard_cdev_drain()) {
+            UNUSED int err = seL4_IRQHandler_Ack(dev->handler.capPtr);
+            assert(err == 0);
+        }
+        seL4_Wait(dev->ep.cptr, NULL);
+    }
+}
+
+/* From here on the IRQ thread reads the keyboard, and we block while
+ * there are no keys. */
+static void
+start_keyboard_irq_thread(chardev_t* dev)
+{
+    UNUSED int err = vka_alloc_async_endpoint(&vka, &event_aep);
+    assert(err == 0);
+    keyboard_cdev_irq_mode(event_aep.cptr, dev->ep.cptr);
+    keyboard_set_wait_output(wait_keyboard_irq, dev);
+
+    err = sel4utils_configure_thread(&vka, &vspace, &vspace, seL4_CapNull, seL4_MaxPrio,
+            simple_get_cnode(&simple), seL4_NilData, &irq_thread);
+    assert(err == 0);
+    err = sel4utils_start_thread(&irq_thread, keyboard_irq_thread, dev, NULL, 1);
+    assert(err == 0);
+
+    /* run below the IRQ thread, so it drains the controller as soon as
+     * the IRQ comes */
+    err = seL4_TCB_SetPriority(seL4_CapInitThreadTCB, seL4_MaxPrio - 1);
+    assert(err == 0);
+}
+#endif /* CONFIG_APP_KEYBOARD4_IRQ */
+
+
 int main()
 {
     UNUSED int err;
@@ -196,6 +282,8 @@ int main()
 
     printf("\n\n>>>>>>>>>> keyboard4 <<<<<<<<<< \n\n");
 
+    init_clock();
+
     chardev_t keyboard;
     init_keyboard(&keyboard);
 
@@ -211,9 +299,14 @@ int main()
         keyboard_flush(&opsIO);
     }
 
+#ifdef CONFIG_APP_KEYBOARD4_IRQ
+    start_keyboard_irq_thread(&keyboard);
+#endif
+
     for (;;) {
         //test key event
         printf("press some keys; press 'k' to change test\n");
+        // polls (or blocks, in IRQ mode) until there is a key event
         for (;;) {
             int16_t vkey;
             int pressed = keyboard_poll_keyevent(&vkey);
@@ -221,15 +314,20 @@ int main()
                 break;
             }
         }
+        trace_dump();
 
         //test char
-        printf("press some keys; press 'l' to change test\n");
+        printf("press some keys; press 'l' to change test, '?' for syscall counts\n");
         int c;
         do {
             c = ps_cdev_getchar(&keyboard.dev);
             if (c != EOF) {
                 printf("%d 0x%x [%c]\n", c, c, c);
             }
+            if (c == '?') {
+                syscall_stats_dump();
+                trace_dump();
+            }
         } while (c !='l' && c !='L');
     }
     return 0;
@@ -19,6 +19,7 @@
 #include <sel4platsupport/arch/io.h>
 #include <sel4utils/vspace.h>
 #include <vka/object_capops.h>
+#include <syscall_stats.h>
 
 #ifdef CONFIG_KERNEL_STABLE
 #include <simple-stable/simple-stable.h>
@@ -160,9 +161,12 @@ void handle_cdev_event(char *msg, chardev_t* dev) {
             break;
         }
         printf("You typed [%c]\n", c);
+        if (c == '?') {
+            syscall_stats_dump();
+        }
     }
 
-    UNUSED int err = seL4_IRQHandler_Ack(dev->handler.capPtr);
+    UNUSED int err = SYSCALL_STATS(seL4_IRQHandler_Ack, dev->handler.capPtr);
     assert(err == 0);
 }
 
@@ -223,8 +227,8 @@ int main()
 
     for (;;) {
         seL4_Word sender_badge;
-        printf("waiting:\n");
-        UNUSED seL4_MessageInfo_t msg = seL4_Wait(aep.cptr, &sender_badge);
+        printf("waiting (type '?' for syscall counts):\n");
+        UNUSED seL4_MessageInfo_t msg = SYSCALL_STATS_WAIT(seL4_Wait, aep.cptr, &sender_badge);
 
         printf("seL4_Wait returned with badge: %d\n", sender_badge);
 
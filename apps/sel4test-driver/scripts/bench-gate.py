@@ -0,0 +1,243 @@
+#!/usr/bin/env python
+#
+# Copyright 2014, NICTA
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(NICTA_BSD)
+#
+
+#
+# Benchmark regression gate. Keep a baseline of benchmark results for each
+# configuration in master-configs, and check new runs against it:
+#
+#   bench-gate.py record kzm_release_xml_defconfig base-1.log base-2.log ...
+#   bench-gate.py check kzm_release_xml_defconfig new-1.log new-2.log ...
+#
+# Every log is parsed with sblog.py, and every run of a benchmark point is
+# one sample of each of its metrics, so more logs (or multiboot.py output)
+# give tighter intervals. For each point and gated metric, check computes a
+# bootstrap confidence interval for the relative change of the median from
+# the baseline to the new run. A slowdown is significant if the whole
+# interval is above the threshold. check exits with 1 if there is any, or if
+# a point of the baseline is missing from the new run (unless
+# --allow-missing). Changes are printed as slowdowns, so positive is worse
+# for every metric.
+#
+# A bootstrap of a handful of samples says nothing (of one sample, its
+# interval has no width at all), so metrics with fewer than --min-samples
+# samples on either side are reported as insufficient instead of gated.
+# Record and check at least that many runs.
+#
+# Metrics where lower is better are gated by default: median, ticks,
+# ps_per_load, kernel_cycles and mean_cycles, and mb_per_s where higher is.
+#
+
+from __future__ import print_function
+
+import sys
+import os
+import json
+import random
+import argparse
+
+import sblog
+
+SCRIPTS_DIR = os.path.dirname(os.path.abspath(__file__))
+MASTER_CONFIGS = os.path.join(SCRIPTS_DIR, '..', '..', '..', 'master-configs')
+
+# metric -> True if lower is better
+DEFAULT_METRICS = {
+    'median': True,
+    'ticks': True,
+    'ps_per_load': True,
+    'kernel_cycles': True,
+    'mean_cycles': True,
+    'mb_per_s': False,
+}
+
+
+def collect(logs):
+    """Map 'bench point' to the samples of each metric in logs"""
+    points = {}
+    for log in logs:
+        with open(log) as lines:
+            for r in sblog.records(lines):
+                key = ('%s %s' % (r.bench, r.point)).strip()
+                metrics = points.setdefault(key, {})
+                for metric, value in r.metrics:
+                    metrics.setdefault(metric, []).append(value)
+    return points
+
+
+def median(values):
+    values = sorted(values)
+    n = len(values)
+    if n % 2:
+        return float(values[n // 2])
+    return (values[n // 2 - 1] + values[n // 2]) / 2.0
+
+
+def bootstrap_change(base, new, resamples, confidence, rng):
+    """The relative change of the median from base to new, with its
+    bootstrap confidence interval, as (low, estimate, high)"""
+    base_median = median(base)
+    if base_median == 0:
+        return None
+    estimate = median(new) / base_median - 1
+
+    changes = []
+    for _ in range(resamples):
+        b = median([rng.choice(base) for _ in base])
+        n = median([rng.choice(new) for _ in new])
+        if b != 0:
+            changes.append(n / b - 1)
+    if not changes:
+        return None
+    changes.sort()
+    tail = (1 - confidence) / 2
+    low = changes[int(tail * (len(changes) - 1))]
+    high = changes[int((1 - tail) * (len(changes) - 1))]
+    return low, estimate, high
+
+
+def baseline_filename(args):
+    return os.path.join(args.baseline_dir, args.config + '.json')
+
+
+def record(args):
+    points = collect(args.logs)
+    if not points:
+        print('no benchmark records in %s' % ' '.join(args.logs), file=sys.stderr)
+        return 2
+    if not os.path.isdir(args.baseline_dir):
+        os.makedirs(args.baseline_dir)
+    with open(baseline_filename(args), 'w') as f:
+        json.dump({'config': args.config, 'logs': len(args.logs), 'points': points}, f,
+                  indent=1, sort_keys=True)
+    print('%d benchmark points from %d logs recorded for %s' % (len(points), len(args.logs), args.config))
+    return 0
+
+
+def check(args):
+    try:
+        with open(baseline_filename(args)) as f:
+            baseline = json.load(f)['points']
+    except (IOError, OSError, ValueError) as e:
+        print('no baseline for %s: %s' % (args.config, e), file=sys.stderr)
+        return 2
+    points = collect(args.logs)
+
+    metrics = dict(DEFAULT_METRICS)
+    if args.metric or args.higher:
+        metrics = dict((m, True) for m in args.metric or [])
+        metrics.update((m, False) for m in args.higher or [])
+
+    rng = random.Random(args.seed)
+    threshold = args.threshold / 100.0
+    slower = 0
+    faster = 0
+    compared = 0
+    insufficient = 0
+    missing = 0
+
+    for key in sorted(set(baseline) | set(points)):
+        if key not in points:
+            print('missing from the new run: %s' % key)
+            missing += 1
+            continue
+        if key not in baseline:
+            print('not in the baseline: %s' % key)
+            continue
+        for metric, lower_is_better in sorted(metrics.items()):
+            base = baseline[key].get(metric)
+            new = points[key].get(metric)
+            if not base or not new:
+                continue
+            if min(len(base), len(new)) < args.min_samples:
+                print('%-8s %s %s: insufficient samples (n=%d/%d, need %d)' %
+                      ('', key, metric, len(base), len(new), args.min_samples))
+                insufficient += 1
+                continue
+            result = bootstrap_change(base, new, args.resamples, args.confidence, rng)
+            if result is None:
+                continue
+            compared += 1
+            low, estimate, high = result
+            if not lower_is_better:
+                # a drop is the slowdown
+                low, estimate, high = -high, -estimate, -low
+
+            if low > threshold:
+                verdict = 'SLOWER'
+                slower += 1
+            elif high < -threshold:
+                verdict = 'faster'
+                faster += 1
+            elif not args.verbose:
+                continue
+            else:
+                verdict = ''
+            print('%-8s %s %s: %+.1f%% [%+.1f%%, %+.1f%%] (n=%d/%d)' %
+                  (verdict, key, metric, 100 * estimate, 100 * low, 100 * high, len(base), len(new)))
+
+    print('%d metrics compared at %.0f%% confidence: %d significantly slower, %d faster than %s '
+          'by more than %.1f%%' % (compared, 100 * args.confidence, slower, faster, args.config,
+                                   args.threshold))
+    if insufficient:
+        print('%d metrics not compared, with fewer than %d samples' % (insufficient, args.min_samples))
+    if missing:
+        print('%d benchmark points missing from the new run%s' %
+              (missing, ', ignored' if args.allow_missing else ''))
+    return 1 if slower or (missing and not args.allow_missing) else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Check benchmark results against a stored baseline')
+    parser.add_argument('--baseline-dir', default=os.path.join(SCRIPTS_DIR, 'baselines'),
+                        help='where baselines are kept (default: %(default)s)')
+    parser.add_argument('--force', action='store_true',
+                        help='allow a configuration that is not in master-configs')
+    commands = parser.add_subparsers(dest='command')
+
+    rec = commands.add_parser('record', help='store the results of logs as the baseline of a config')
+    rec.add_argument('config', help='name of the configuration, as in master-configs')
+    rec.add_argument('logs', nargs='+', help='console output of sel4test runs')
+
+    chk = commands.add_parser('check', help='check the results of logs against the baseline')
+    chk.add_argument('config', help='name of the configuration, as in master-configs')
+    chk.add_argument('logs', nargs='+', help='console output of sel4test runs')
+    chk.add_argument('--threshold', type=float, default=5.0,
+                     help='percentage slowdown to tolerate (default: %(default)s)')
+    chk.add_argument('--confidence', type=float, default=0.95,
+                     help='confidence level of the intervals (default: %(default)s)')
+    chk.add_argument('--resamples', type=int, default=1000,
+                     help='bootstrap resamples per metric (default: %(default)s)')
+    chk.add_argument('--min-samples', type=int, default=5,
+                     help='samples needed on each side to compare a metric (default: %(default)s)')
+    chk.add_argument('--allow-missing', action='store_true',
+                     help='do not fail when points of the baseline are missing from the new run')
+    chk.add_argument('--seed', type=int, default=0,
+                     help='seed of the resampling, for repeatable results')
+    chk.add_argument('--metric', action='append',
+                     help='gate this metric, where lower is better (may be repeated)')
+    chk.add_argument('--higher', action='append',
+                     help='gate this metric, where higher is better (may be repeated)')
+    chk.add_argument('-v', '--verbose', action='store_true',
+                     help='also print the metrics that did not change significantly')
+    args = parser.parse_args()
+
+    if args.command is None:
+        parser.error('record or check?')
+    if not args.force and not os.path.exists(os.path.join(MASTER_CONFIGS, args.config)):
+        parser.error('%s is not in master-configs, use --force to use it anyway' % args.config)
+
+    if args.command == 'record':
+        return record(args)
+    return check(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
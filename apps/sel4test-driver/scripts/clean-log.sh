@@ -1,12 +0,0 @@
-#!/bin/sh
-#
-# Copyright 2014, NICTA
-#
-# This software may be distributed and modified according to the terms of
-# the BSD 2-Clause license. Note that NO WARRANTY is provided.
-# See "LICENSE_BSD2.txt" for details.
-#
-# @TAG(NICTA_BSD)
-#
-
-exec cat "$@" |sed -e 's/\cM//' | grep '^SB&'
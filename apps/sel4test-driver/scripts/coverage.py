@@ -17,13 +17,49 @@
 #
 # coverage.py staging/arm/imx31/kernel.elf /tmp/qemu.log --functions --objdump | less -R
 #
+# The log is read in chunks by one process per CPU (see --jobs), and the
+# parsed objdump output is cached by the hash of the ELF file (see
+# --cache-dir), so repeated runs against the same kernel skip objdump.
+#
+# With --profile the instructions are counted instead, per address and per
+# call stack, giving a list of the hottest functions and, with --folded, the
+# input for flamegraph.pl:
+#
+# coverage.py kernel.elf /tmp/qemu.log --profile --folded kernel.folded
+# flamegraph.pl kernel.folded > kernel.svg
+#
+
+from __future__ import print_function
 
 import sys
 import os
 import re
 import argparse
+import hashlib
+import multiprocessing
 from subprocess import Popen, PIPE
 
+try:
+    import cPickle as pickle
+except ImportError:
+    import pickle
+
+# don't bother splitting the log into chunks smaller than this
+CHUNK_MIN = 16 * 1024 * 1024
+
+# bump when the output of parse_objdump changes, to ignore old caches
+OBJDUMP_CACHE_VERSION = 3
+
+# ARM condition codes, for recognising conditional calls and returns
+ARM_CONDITIONS = set(['eq', 'ne', 'cs', 'cc', 'hs', 'lo', 'mi', 'pl', 'vs', 'vc',
+                      'hi', 'ls', 'ge', 'lt', 'gt', 'le', 'al'])
+
+# addressing modes of ldm, which come before or after the condition
+ARM_LDM_MODES = ('', 'ia', 'ib', 'da', 'db', 'fd', 'fa', 'ed', 'ea')
+
+# how --profile names code outside the ELF file
+UNKNOWN_FUNCTION = '[unknown]'
+
 class Colors(object):
     def __init__(self, use_color):
         c = {}
@@ -61,116 +97,428 @@ def get_tool(toolname):
 
     return os.environ.get('TOOLPREFIX', default_prefix) + toolname
 
-def main():
-    parser = argparse.ArgumentParser(
-        description='Generate coverage information of a binary.')
-    parser.add_argument('kernel_elf_filename', metavar='<kernel ELF>',
-        type=str, help='The kernel ELF file used for the log.')
-    parser.add_argument('coverage_filename', metavar='<qemu log>',
-        type=str, help='The qemu logfile containing the instruction trace.')
-    parser.add_argument('--functions', action='store_true',
-        help='Produce a summary of the functions covered.')
-    parser.add_argument('--objdump', action='store_true',
-        help='Produce an objdump with coverage information.')
-    parser.add_argument('--no-color', action='store_true', default=False,
-        help='Produce coloured output.')
-
-    args = parser.parse_args()
-    colors = Colors(not args.no_color)
-
-    # We will need to run objdump on the ELF file.
-    kernel_elf_filename = args.kernel_elf_filename
-
-    # This is the raw qemu.log file.
-    coverage_filename = args.coverage_filename
-
-    # Run objdump on the kernel binary.
-    objdump_proc = Popen([get_tool('objdump'), '-d', '-j', '.text', kernel_elf_filename], stdout=PIPE)
+def default_cache_dir():
+    base = os.environ.get('XDG_CACHE_HOME', os.path.join(os.path.expanduser('~'), '.cache'))
+    return os.path.join(base, 'sel4-coverage')
+
+def arm_condition(mnemonic, base, modes=('',)):
+    """The condition of an ARM mnemonic made of base, an optional condition
+    and one of modes (in either order, as older objdumps put the condition
+    first): '' if it has none, or None if the mnemonic is something else."""
+    if not mnemonic.startswith(base):
+        return None
+    rest = mnemonic[len(base):]
+    for mode in modes:
+        if rest == mode:
+            return ''
+        for cond in ARM_CONDITIONS:
+            if rest in (cond + mode, mode + cond):
+                return cond
+    return None
+
+def instruction_kind(line):
+    """Whether the instruction on an objdump line is a call or a return, as
+    (kind, conditional), or None if it is neither. Only the usual ARM and x86
+    forms are known."""
+    # address, encoding, then mnemonic and operands
+    fields = line.split('\t', 2)
+    if len(fields) < 3:
+        return None
+    insn = fields[2].split(None, 1)
+    if not insn:
+        return None
+    # thumb-2 width suffixes don't matter here
+    mnemonic = insn[0].split('.')[0]
+    operands = insn[1].split(';')[0].replace(' ', '') if len(insn) > 1 else ''
+
+    if mnemonic in ('call', 'calll', 'callq'):
+        return ('call', False)
+    if mnemonic in ('ret', 'retl', 'retq'):
+        return ('return', False)
+    # gcc pads returns that are branch targets to "repz ret" for older AMD
+    # branch predictors
+    if mnemonic in ('rep', 'repz') and operands in ('ret', 'retl', 'retq'):
+        return ('return', False)
+
+    kind = None
+    cond = arm_condition(mnemonic, 'bl')
+    if cond is None:
+        cond = arm_condition(mnemonic, 'blx')
+    if cond is not None:
+        kind = 'call'
+    else:
+        if operands == 'lr':
+            cond = arm_condition(mnemonic, 'bx')
+        elif operands == 'pc,lr':
+            cond = arm_condition(mnemonic, 'mov')
+        elif 'pc}' in operands and not operands.endswith('^'):
+            cond = arm_condition(mnemonic, 'pop')
+            if cond is None:
+                cond = arm_condition(mnemonic, 'ldm', ARM_LDM_MODES)
+        if cond is not None:
+            kind = 'return'
+    if kind is None:
+        return None
+    return (kind, cond not in ('', 'al'))
+
+def parse_objdump(kernel_elf_filename):
+    """Run objdump on the kernel binary, and retain the following data:
+
+    lines: the objdump output.
+    addresses: a map from line number within the objdump output to the
+        address of the instruction on it, None if it has none.
+    functions: a map from function name to a list of all executable
+        instructions within it.
+    vector_table: the address of arm_vector_table, if there is one.
+    kinds: a map from address to ('call' or 'return', fall through), for
+        the instructions that are either. The fall through is the address
+        of the next instruction if the call or return is conditional, so
+        it can be told whether it was taken, otherwise None."""
+    objdump_proc = Popen([get_tool('objdump'), '-d', '-j', '.text', kernel_elf_filename],
+                         stdout=PIPE, universal_newlines=True)
     objdump_lines = objdump_proc.stdout.readlines()
+    objdump_proc.wait()
 
     seL4_arm_vector_table_address = None
-
-    # Now, parse the objdump file and retain the following data:
-
-    # A map from address to line number within the objdump file.
-    addr2lineno = {}
-
-    # Can be seen as a map from line number in objdump file -> address.
-    objdump_addreses = []
-
-    # A map from function name to a set of all executable instructions within
-    # it.
+    objdump_addresses = []
     function_instructions = {}
+    instruction_kinds = {}
 
+    conditional = []
     current_function = None
     line_re = re.compile(r'^([0-9a-f]+):')
     ignore_re = re.compile(r'\.word|\.short|\.byte|undefined instruction')
     function_name_re = re.compile(r'^([0-9a-f]+) <([^>]+)>')
-    for i, line in enumerate(objdump_lines):
+    for line in objdump_lines:
         addr = None
         g = line_re.match(line)
         if g:
             g2 = ignore_re.search(line)
             if not g2:
                 addr = int(g.group(1), 16)
-                addr2lineno[addr] = i
+                kind = instruction_kind(line)
+                if kind is not None:
+                    instruction_kinds[addr] = (kind[0], None)
+                    if kind[1]:
+                        conditional.append(addr)
 
-        objdump_addreses.append(addr)
+        objdump_addresses.append(addr)
 
         if current_function is not None and addr is not None:
-            function_instructions[current_function].add(addr)
+            function_instructions[current_function].append(addr)
 
         g = function_name_re.search(line)
         if g:
             current_function = g.group(2)
-            function_instructions[current_function] = set()
+            function_instructions[current_function] = []
 
             if current_function == 'arm_vector_table':
                 seL4_arm_vector_table_address = int(g.group(1), 16)
 
+    # the instruction after a conditional one is where it falls through to
+    listed = sorted(set(a for a in objdump_addresses if a is not None))
+    following = dict(zip(listed, listed[1:]))
+    for addr in conditional:
+        instruction_kinds[addr] = (instruction_kinds[addr][0], following.get(addr))
+
+    return {
+        'lines': objdump_lines,
+        'addresses': objdump_addresses,
+        'functions': function_instructions,
+        'vector_table': seL4_arm_vector_table_address,
+        'kinds': instruction_kinds,
+    }
+
+def load_objdump(kernel_elf_filename, cache_dir):
+    """parse_objdump, cached in cache_dir by the hash of the ELF file and the
+    objdump used, as objdump is slow on a large kernel"""
+    if cache_dir is None:
+        return parse_objdump(kernel_elf_filename)
+
+    digest = hashlib.sha1(('%s %d' % (get_tool('objdump'), OBJDUMP_CACHE_VERSION)).encode())
+    with open(kernel_elf_filename, 'rb') as elf:
+        for block in iter(lambda: elf.read(1 << 20), b''):
+            digest.update(block)
+    cache_filename = os.path.join(cache_dir, digest.hexdigest() + '.pickle')
+
+    try:
+        with open(cache_filename, 'rb') as cache:
+            return pickle.load(cache)
+    except (IOError, OSError, EOFError, ValueError, pickle.UnpicklingError):
+        pass
+
+    objdump = parse_objdump(kernel_elf_filename)
+    try:
+        if not os.path.isdir(cache_dir):
+            os.makedirs(cache_dir)
+        # write and rename, so a concurrent run never reads half a file
+        tmp_filename = '%s.%d' % (cache_filename, os.getpid())
+        with open(tmp_filename, 'wb') as cache:
+            # protocol 2 is the newest that python 2 can read
+            pickle.dump(objdump, cache, 2)
+        os.rename(tmp_filename, cache_filename)
+    except (IOError, OSError) as e:
+        print('Not caching objdump output: %s' % e, file=sys.stderr)
+    return objdump
+
+def scan_chunk(chunk):
+    """Return the distinct addresses in the trace lines that start within
+    the byte range [start, end) of the log, still as hex strings. Loops make
+    the same address appear millions of times, so only the distinct ones are
+    worth converting and looking up."""
+    filename, start, end = chunk
+    seen = set()
+    with open(filename, 'rb') as log:
+        pos = start
+        if start > 0:
+            # a line that straddles start belongs to the previous chunk
+            log.seek(start - 1)
+            pos += len(log.readline()) - 1
+        for line in log:
+            if pos >= end:
+                break
+            pos += len(line)
+            if line.startswith(b'Trace '):
+                open_bracket = line.find(b'[')
+                close_bracket = line.find(b']', open_bracket)
+                if open_bracket > 0 and close_bracket > 0:
+                    seen.add(line[open_bracket + 1:close_bracket])
+    return seen
+
+def trace_addresses(coverage_filename, jobs):
+    """Return the set of addresses executed in the qemu log, reading chunks
+    of it in jobs processes"""
+    size = os.path.getsize(coverage_filename)
+    jobs = max(1, jobs)
+    # a few chunks per process, so one slow chunk doesn't hold up the rest
+    num_chunks = max(1, min(jobs * 4, size // CHUNK_MIN))
+    chunk_size = size // num_chunks + 1
+    chunks = [(coverage_filename, start, min(start + chunk_size, size))
+              for start in range(0, size, chunk_size)] or [(coverage_filename, 0, 0)]
+
+    if jobs > 1 and len(chunks) > 1:
+        pool = multiprocessing.Pool(jobs)
+        try:
+            results = pool.map(scan_chunk, chunks)
+        finally:
+            pool.close()
+            pool.join()
+    else:
+        results = [scan_chunk(c) for c in chunks]
+
+    executed = set()
+    for field in set().union(*results):
+        # newer versions of qemu print several fields, the pc is the second
+        if b'/' in field:
+            field = field.split(b'/')[1]
+        try:
+            executed.add(int(field, 16))
+        except ValueError:
+            continue
+    return executed
+
+def profile_trace(coverage_filename, objdump):
+    """Read the log in order, counting how often each address was executed
+    and each call stack was seen. Stacks are rebuilt from the call and
+    return instructions: a call pushes the function executed next, a return
+    pops. When control reaches another function any other way (a tail call,
+    an exception, a switch to or from code outside the ELF file), the stack
+    is unwound to that function if it is on it, else the top is replaced, or
+    the stack restarted when crossing into or out of the ELF file.
+
+    Returns a map from address to count, and a map from folded stack (the
+    functions outermost first, separated by ';') to count.
+
+    A conditional call or return only counts if the next instruction traced
+    is not the one it falls through to. An exception taken just after one
+    that was not taken makes it look taken, which the unwinding mends when
+    the exception returns."""
+    function_of = {}
+    for f, instructions in objdump['functions'].items():
+        for addr in instructions:
+            function_of[addr] = f
+    kinds = objdump['kinds']
+    vector_table = objdump['vector_table']
+
+    # the trace field of an address -> (address, function, (kind, fall through))
+    known = {}
+    field_counts = {}
+    stack_counts = {}
+
+    stack = [UNKNOWN_FUNCTION]
+    folded = [UNKNOWN_FUNCTION]
+    pending = None
+
+    with open(coverage_filename, 'rb') as log:
+        for line in log:
+            if not line.startswith(b'Trace '):
+                continue
+            open_bracket = line.find(b'[')
+            close_bracket = line.find(b']', open_bracket)
+            if open_bracket < 0 or close_bracket < 0:
+                continue
+            field = line[open_bracket + 1:close_bracket]
+
+            info = known.get(field)
+            if info is None:
+                addr = field.split(b'/')[1] if b'/' in field else field
+                try:
+                    addr = int(addr, 16)
+                except ValueError:
+                    continue
+                # see the vectors page hack in main
+                if 0xffff0000 <= addr <= 0xffff1000 and vector_table is not None:
+                    addr = addr - 0xffff0000 + vector_table
+                info = known[field] = (addr, function_of.get(addr, UNKNOWN_FUNCTION), kinds.get(addr))
+            field_counts[field] = field_counts.get(field, 0) + 1
+            addr, function, kind = info
+
+            if pending is not None and pending[1] == addr:
+                # a conditional call or return that was not taken
+                pass
+            elif pending is not None and pending[0] == 'call':
+                stack.append(function)
+                folded.append(folded[-1] + ';' + function)
+            elif pending is not None and pending[0] == 'return' and len(stack) > 1:
+                stack.pop()
+                folded.pop()
+
+            if stack[-1] != function:
+                if function in stack:
+                    depth = len(stack) - 1 - stack[::-1].index(function)
+                    del stack[depth + 1:]
+                    del folded[depth + 1:]
+                elif (function == UNKNOWN_FUNCTION) != (stack[-1] == UNKNOWN_FUNCTION):
+                    stack = [function]
+                    folded = [function]
+                else:
+                    stack[-1] = function
+                    folded[-1] = folded[-2] + ';' + function if len(folded) > 1 else function
+
+            key = folded[-1]
+            stack_counts[key] = stack_counts.get(key, 0) + 1
+            pending = kind
+
+    addr_counts = {}
+    for field, count in field_counts.items():
+        addr = known[field][0]
+        addr_counts[addr] = addr_counts.get(addr, 0) + count
+    return addr_counts, stack_counts
+
+def print_hot_list(stack_counts, top, colors):
+    """Print the functions that executed the most instructions, themselves
+    (self) and including their callees (total)"""
+    self_counts = {}
+    total_counts = {}
+    for key, count in stack_counts.items():
+        functions = key.split(';')
+        self_counts[functions[-1]] = self_counts.get(functions[-1], 0) + count
+        for f in set(functions):
+            total_counts[f] = total_counts.get(f, 0) + count
+    executed = sum(stack_counts.values())
+    if not executed:
+        return
+
+    print('%d instructions executed' % executed)
+    print('%12s %6s %12s %6s  %s' % ('self', 'self%', 'total', 'total%', 'function'))
+    hot = sorted(self_counts.items(), key=lambda fc: -fc[1])
+    for f, count in hot[:top]:
+        colour = colors.LIGHT_GREY if f == UNKNOWN_FUNCTION else colors.NORMAL
+        line = '%12d %5.1f%% %12d %5.1f%%  %s\n' % (count, 100.0 * count / executed, total_counts[f],
+                                                    100.0 * total_counts[f] / executed, f)
+        sys.stdout.write(colour + line + colors.NORMAL)
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Generate coverage information of a binary.')
+    parser.add_argument('kernel_elf_filename', metavar='<kernel ELF>',
+        type=str, help='The kernel ELF file used for the log.')
+    parser.add_argument('coverage_filename', metavar='<qemu log>',
+        type=str, help='The qemu logfile containing the instruction trace.')
+    parser.add_argument('--functions', action='store_true',
+        help='Produce a summary of the functions covered.')
+    parser.add_argument('--objdump', action='store_true',
+        help='Produce an objdump with coverage information.')
+    parser.add_argument('--no-color', action='store_true', default=False,
+        help='Produce coloured output.')
+    parser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count(),
+        help='Number of processes reading the log (default: one per CPU).')
+    parser.add_argument('--cache-dir', type=str, default=default_cache_dir(),
+        help='Where to keep parsed objdump output (default: %(default)s).')
+    parser.add_argument('--no-cache', action='store_true', default=False,
+        help='Always run objdump, and do not cache its output.')
+    parser.add_argument('--profile', action='store_true',
+        help='Count executions per address and function, and list the hottest functions.')
+    parser.add_argument('--top', type=int, default=30,
+        help='Number of functions in the --profile hot list (default: %(default)s).')
+    parser.add_argument('--folded', type=str, metavar='<file>',
+        help='With --profile, write the call stacks in folded format for flamegraph.pl.')
+
+    args = parser.parse_args()
+    colors = Colors(not args.no_color)
+
+    # We will need to run objdump on the ELF file.
+    kernel_elf_filename = args.kernel_elf_filename
+
+    # This is the raw qemu.log file.
+    coverage_filename = args.coverage_filename
+
+    objdump = load_objdump(kernel_elf_filename, None if args.no_cache else args.cache_dir)
+    objdump_lines = objdump['lines']
+    objdump_addresses = objdump['addresses']
+    function_instructions = objdump['functions']
+    seL4_arm_vector_table_address = objdump['vector_table']
+
+    # All executable instructions in the ELF file.
+    instructions = set(a for a in objdump_addresses if a is not None)
+
+    if args.folded and not args.profile:
+        parser.error('--folded needs --profile')
+
+    # The profile needs the log in order, so it can't be split up.
+    addr_counts = {}
+    stack_counts = {}
     try:
-        coverage_file = open(coverage_filename, 'r')
-    except:
-        print >>sys.stderr, 'Failed to open %s' % coverage_filename
+        if args.profile:
+            addr_counts, stack_counts = profile_trace(coverage_filename, objdump)
+            executed = set(addr_counts)
+        else:
+            executed = trace_addresses(coverage_filename, args.jobs)
+    except (IOError, OSError):
+        print('Failed to open %s' % coverage_filename, file=sys.stderr)
         return -1
 
-    # Record all executable instructions in the ELF file into a set.
+    # Record the executed instructions that are in the ELF file.
     covered_instructions = set()
-    trace_entry = re.compile(r'^Trace 0x[0-f]+ \[([0-f]+)\]')
-    for line in coverage_file.readlines():
-        entry = re.search(trace_entry, line)
-        if not entry:
-            continue
-        addr = int(entry.group(1), 16)
-        if addr in addr2lineno:
+    for addr in executed:
+        if addr in instructions:
             covered_instructions.add(addr)
 
         # Sigh. And of course, here are some seL4-specific hacks. The vectors page
         # is not at the correct address in the binary. It is mapped at 0xffff0000
         # in memory, but starts at arm_vector_table in the binary. Account for that
-        # here.
-        if 0xffff0000 <= addr <= 0xffff1000 and seL4_arm_vector_table_address is not None:
+        # here. (profile_trace has done it already.)
+        if not args.profile and 0xffff0000 <= addr <= 0xffff1000 and seL4_arm_vector_table_address is not None:
             covered_instructions.add(addr - 0xffff0000 + seL4_arm_vector_table_address)
-    coverage_file.close()
 
     # Print basic information.
     num_covered = len(covered_instructions)
-    num_total = len(addr2lineno)
-    print '%d/%d instructions covered (%.1f%%)' % (
+    num_total = len(instructions)
+    print('%d/%d instructions covered (%.1f%%)' % (
          num_covered, num_total,
-         100.0 * num_covered / num_total)
+         100.0 * num_covered / num_total))
 
     if args.functions:
         # For each function, calculate how many instructions were covered.
         function_coverage = {}
-        for f,instructions in function_instructions.iteritems():
+        for f, instructions in function_instructions.items():
             num_instructions = len(instructions)
             if num_instructions > 0:
-                covered = len(instructions.intersection(covered_instructions))
+                covered = len(covered_instructions.intersection(instructions))
                 function_coverage[f] = (covered, num_instructions)
 
         # Sort by coverage and print.
-        for f,x in sorted(function_coverage.items(), key=lambda (f,x): 1.0 * x[0] / x[1]):
+        for f, x in sorted(function_coverage.items(), key=lambda fx: 1.0 * fx[1][0] / fx[1][1]):
             pct = 100.0 * x[0] / x[1]
 
             if pct == 0.0:
@@ -186,9 +534,9 @@ def main():
     if args.objdump:
         # Print a coloured objdump.
         for i, line in enumerate(objdump_lines):
-            addr = objdump_addreses[i]
+            addr = objdump_addresses[i]
             covered = addr in covered_instructions
-            valid = addr in addr2lineno
+            valid = addr is not None
             if covered:
                 colour = colors.DARK_GREEN
             elif valid:
@@ -196,8 +544,18 @@ def main():
             else:
                 colour = colors.LIGHT_GREY
 
+            if args.profile:
+                line = '%10s %s' % (addr_counts.get(addr, '') if valid else '', line)
             sys.stdout.write(colour + line + colors.NORMAL)
 
+    if args.profile:
+        print_hot_list(stack_counts, args.top, colors)
+
+    if args.folded:
+        with open(args.folded, 'w') as folded:
+            for key, count in sorted(stack_counts.items()):
+                folded.write('%s %d\n' % (key, count))
+
     return 0
 
 if __name__ == '__main__':
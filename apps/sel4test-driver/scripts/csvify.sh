@@ -9,5 +9,6 @@
 # @TAG(NICTA_BSD)
 #
 
-exec ./clean-log.sh "$@" | ./match-data.pl | ./generate-csv.pl
-
+# see parselog.sh for the sweep of the IPC benchmark
+exec ./sblog.py --format csv --sweep prio=98.. --sweep 'dir=->,<-' --sweep length=0..10 \
+    --iterations 10000 --overhead measure_bench_overhead "$@"
@@ -10,12 +10,46 @@
 #
 
 # Auto-generates list of tests from tests app for the test driver app to use.
+# Tests whose names (less TEST_) do not start with the optional prefix are
+# left out of the list, which is what sel4test_run_tests runs and counts,
+# and named in skipped_test_names instead. It is an error for a prefix to
+# match no test.
 
-if [ $# -ne 2 ]; then
-    echo "Usage: $0 objdump-command target-image" 1>&2
+if [ $# -ne 2 ] && [ $# -ne 3 ]; then
+    echo "Usage: $0 objdump-command target-image [prefix]" 1>&2
     exit 1
 fi
+prefix=$3
 
-echo "#include <sel4test/test.h>"
-echo ""; $1 -t -j _test_case $2 | grep -E " [lg][ ]+O _test_case.*TEST_" | tr -s ' ' | cut -d ' ' -f 5 | sort | while read line; do echo "__attribute__((used)) __attribute__((section(\"_test_case\"))) testcase_t ${line} = { .name = \"${line}\"};"; done; echo ""
+tests=$($1 -t -j _test_case $2 | grep -E " [lg][ ]+O _test_case.*TEST_" | tr -s ' ' | cut -d ' ' -f 5 | sort)
+cases=""
+num_cases=0
+skipped=""
+num_skipped=0
+
+for line in ${tests}; do
+    if [[ "${line#TEST_}" == "${prefix}"* ]]; then
+        cases="${cases}__attribute__((used)) __attribute__((section(\"_test_case\"))) testcase_t ${line} = { .name = \"${line}\"};\n"
+        num_cases=$((num_cases + 1))
+    else
+        skipped="${skipped}    \"${line}\",\n"
+        num_skipped=$((num_skipped + 1))
+    fi
+done
+
+# A prefix that matches nothing is most likely a typo, and would otherwise
+# build a driver that runs no tests and passes.
+if [ -n "${prefix}" ] && [ ${num_cases} -eq 0 ]; then
+    echo "$0: no test matches prefix \"${prefix}\"" 1>&2
+    exit 1
+fi
 
+echo "#include <sel4test/test.h>"
+echo ""
+echo -ne "${cases}"
+echo ""
+echo "const char *skipped_test_names[] = {"
+echo -ne "${skipped}"
+echo "    NULL"
+echo "};"
+echo "const int num_skipped_tests = ${num_skipped};"
@@ -0,0 +1,180 @@
+#!/usr/bin/env python
+#
+# Copyright 2014, NICTA
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(NICTA_BSD)
+#
+
+#
+# Report how often IPC takes the kernel's fast path, per user level function
+# and message shape, from a qemu execution trace. Make the trace with
+#
+#   make trace-kzm        (or trace-ia32)
+#
+# which runs qemu with "-singlestep -d exec,cpu", ideally with the driver's
+# TEST_PREFIX set to "IPC" so only the IPC tests run. Then
+#
+#   fastpath-rate.py kernel.elf sel4test-tests.bin images/qemu-trace.log
+#
+# A fast path attempt is an entry to one of the fast path functions. It
+# misses if the kernel reaches the slow path before returning to user level.
+# The attempt is charged to the last function of the tests ELF that ran at
+# user level, e.g. call_func in tests/ipc.c. Other processes (the driver) are
+# linked at the same addresses, so a few attempts may be charged to the
+# wrong function. With ",cpu" in the trace, the message info argument on
+# entry to the fast path gives the message length and extra caps of each
+# attempt.
+#
+
+from __future__ import print_function
+
+import sys
+import os
+import re
+import argparse
+from subprocess import Popen, PIPE
+
+FASTPATH = ['fastpath_call', 'fastpath_reply_wait']
+SLOWPATH = ['slowpath']
+
+trace_entry = re.compile(r'^Trace 0x[0-9a-f]+ \[([0-9a-f]+)\]')
+# the register holding the message info on entry to the fast path: r1 on
+# ARM, esi on ia32
+msginfo_re = re.compile(r'\b(?:R01|ESI)=([0-9a-f]{8})')
+
+
+def get_tool(toolname):
+    default_prefix = 'arm-none-eabi-'
+
+    return os.environ.get('TOOLPREFIX', default_prefix) + toolname
+
+
+class Symbols(object):
+    """Function symbols of an ELF file, for looking up addresses"""
+
+    def __init__(self, elf):
+        nm = Popen([get_tool('nm'), '-S', '--defined-only', elf], stdout=PIPE, universal_newlines=True)
+        self.funcs = []
+        self.by_name = {}
+        for line in nm.stdout:
+            fields = line.split()
+            if len(fields) != 4 or fields[2] not in 'tTwW':
+                continue
+            start, size = int(fields[0], 16), int(fields[1], 16)
+            self.funcs.append((start, start + size, fields[3]))
+            self.by_name[fields[3]] = start
+        nm.wait()
+        self.funcs.sort()
+        self.starts = [f[0] for f in self.funcs]
+        self.low = self.funcs[0][0] if self.funcs else 0
+        self.high = self.funcs[-1][1] if self.funcs else 0
+
+    def lookup(self, addr):
+        if not self.low <= addr < self.high:
+            return None
+        # binary search for the last function starting at or before addr
+        lo, hi = 0, len(self.starts)
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if self.starts[mid] <= addr:
+                lo = mid + 1
+            else:
+                hi = mid
+        if lo == 0:
+            return None
+        start, end, name = self.funcs[lo - 1]
+        return name if addr < end else None
+
+
+class Attempt(object):
+    def __init__(self, function, path):
+        self.function = function
+        self.path = path
+        self.shape = None
+        self.missed = False
+
+
+def main():
+    parser = argparse.ArgumentParser(description='IPC fast path hit rate from a qemu trace.')
+    parser.add_argument('kernel_elf', help='the kernel ELF file used for the trace')
+    parser.add_argument('user_elf', help='the user level ELF to charge attempts to (sel4test-tests)')
+    parser.add_argument('trace', help='qemu log made with -singlestep -d exec[,cpu]')
+    parser.add_argument('--fastpath', action='append',
+                        help='fast path entry function (default: %s)' % ', '.join(FASTPATH))
+    parser.add_argument('--slowpath', action='append',
+                        help='slow path entry function (default: %s)' % ', '.join(SLOWPATH))
+    args = parser.parse_args()
+
+    kernel = Symbols(args.kernel_elf)
+    user = Symbols(args.user_elf)
+
+    fastpath = dict((kernel.by_name[f], f) for f in args.fastpath or FASTPATH if f in kernel.by_name)
+    slowpath = set(kernel.by_name[f] for f in args.slowpath or SLOWPATH if f in kernel.by_name)
+    if not fastpath:
+        print('no fast path functions in %s, was it built with FASTPATH?' % args.kernel_elf,
+              file=sys.stderr)
+        return 1
+
+    attempts = []
+    pending = None
+    want_regs = False
+    function = None
+
+    with open(args.trace) as trace:
+        for line in trace:
+            entry = trace_entry.match(line)
+            if entry is None:
+                if want_regs:
+                    m = msginfo_re.search(line)
+                    if m:
+                        info = int(m.group(1), 16)
+                        # length is the low 7 bits, extra caps the next 2
+                        pending.shape = 'len=%d caps=%d' % (info & 0x7f, (info >> 7) & 0x3)
+                        want_regs = False
+                continue
+
+            addr = int(entry.group(1), 16)
+            if addr in fastpath:
+                pending = Attempt(function, fastpath[addr])
+                attempts.append(pending)
+                want_regs = True
+            elif addr in slowpath:
+                if pending is not None:
+                    pending.missed = True
+                    pending = None
+                want_regs = False
+            elif addr < kernel.low:
+                # back at user level
+                pending = None
+                want_regs = False
+                name = user.lookup(addr)
+                if name is not None:
+                    function = name
+
+    # function, path, shape -> [attempts, misses]
+    table = {}
+    for a in attempts:
+        key = (a.function or '?', a.path, a.shape or '-')
+        counts = table.setdefault(key, [0, 0])
+        counts[0] += 1
+        counts[1] += a.missed
+
+    print('%-28s %-20s %-14s %9s %9s %7s' % ('function', 'path', 'shape', 'attempts', 'misses', 'hit%'))
+    for key in sorted(table):
+        total, misses = table[key]
+        print('%-28s %-20s %-14s %9d %9d %6.1f%%' % (key + (total, misses, 100.0 * (total - misses) / total)))
+
+    total = len(attempts)
+    misses = sum(a.missed for a in attempts)
+    if total:
+        print('\n%d fast path attempts, %d missed, %.1f%% hit rate' %
+              (total, misses, 100.0 * (total - misses) / total))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+#
+# Copyright 2014, NICTA
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(NICTA_BSD)
+#
+
+#
+# Compare the benchmark records of two sel4test runs made with
+# APP_TESTS_BENCH_ICOUNT under "make simulate-ia32-icount" (or -kzm-). The
+# metrics are instruction counts, so they only change when the code does,
+# and any difference is reported. Exits with 1 if a metric changed by more
+# than the tolerance, or a record is missing from either run.
+#
+# icount-compare.py base.log new.log [--tolerance 0.5] [--metric median ...]
+#
+
+from __future__ import print_function
+
+import sys
+import argparse
+
+PREFIX = 'SB& '
+
+
+def parse(lines):
+    """Map (benchmark, params) to the metrics of every SB& record"""
+    records = {}
+    for line in lines:
+        line = line.strip()
+        start = line.find(PREFIX)
+        if start < 0:
+            continue
+        head, sep, tail = line[start + len(PREFIX):].partition(' : ')
+        if not sep:
+            continue
+        fields = head.split()
+        metrics = {}
+        for pair in tail.split():
+            key, _, value = pair.partition('=')
+            try:
+                metrics[key] = int(value)
+            except ValueError:
+                continue
+        records[(fields[0], ' '.join(fields[1:]))] = metrics
+    return records
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare instruction counted benchmark runs')
+    parser.add_argument('base', type=argparse.FileType('r'), help='output of the base build')
+    parser.add_argument('new', type=argparse.FileType('r'), help='output of the new build')
+    parser.add_argument('--tolerance', type=float, default=0.0,
+                        help='percentage change to allow (default: none)')
+    parser.add_argument('--metric', action='append',
+                        help='only compare this metric (may be repeated, default: all)')
+    args = parser.parse_args()
+
+    base = parse(args.base)
+    new = parse(args.new)
+
+    timed = [key for key in list(base) + list(new) if 'clock=icount' not in key[1].split()]
+    if timed:
+        print('warning: %d records were not made with APP_TESTS_BENCH_ICOUNT, '
+              'their differences may be noise' % len(timed), file=sys.stderr)
+
+    failed = 0
+    for key in sorted(set(base) | set(new)):
+        name = ('%s %s' % key).strip()
+        if key not in new:
+            print('missing from new: %s' % name)
+            failed += 1
+            continue
+        if key not in base:
+            print('missing from base: %s' % name)
+            failed += 1
+            continue
+
+        for metric in sorted(set(base[key]) | set(new[key])):
+            if args.metric and metric not in args.metric:
+                continue
+            old_value = base[key].get(metric)
+            new_value = new[key].get(metric)
+            if old_value == new_value:
+                continue
+            if old_value is None or new_value is None:
+                print('%s: %s only in one run' % (name, metric))
+                failed += 1
+                continue
+            change = 100.0 * (new_value - old_value) / old_value if old_value else float('inf')
+            over = abs(change) > args.tolerance
+            print('%s %s: %d -> %d (%+.2f%%)%s' % (name, metric, old_value, new_value, change,
+                                                 '' if over else ' within tolerance'))
+            if over:
+                failed += 1
+
+    print('%d records compared, %d differences' % (len(set(base) & set(new)), failed))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
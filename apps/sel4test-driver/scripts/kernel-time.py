@@ -0,0 +1,97 @@
+#!/usr/bin/env python
+#
+# Copyright 2014, NICTA
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(NICTA_BSD)
+#
+
+#
+# Split the time each test took between the kernel and user level, from the
+# "SB& klog" records the driver prints when the kernel is built with
+# CONFIG_BENCHMARK. Total (and so user) cycles are only known if the driver
+# was built with APP_SHARED_PMU.
+#
+# kernel-time.py sel4test.log [--sort kernel|total|entries|name]
+#
+
+from __future__ import print_function
+
+import sys
+import re
+import argparse
+
+KLOG = re.compile(r'^SB& klog test=(\S+) : (.*)$')
+
+
+def parse(lines):
+    """Yield (test, metrics) for every klog record"""
+    for line in lines:
+        # serial output can have carriage returns and leading noise
+        line = line.strip()
+        start = line.find('SB& klog ')
+        if start < 0:
+            continue
+        match = KLOG.match(line[start:])
+        if match is None:
+            continue
+        metrics = {}
+        for pair in match.group(2).split():
+            key, _, value = pair.partition('=')
+            metrics[key] = int(value)
+        yield match.group(1), metrics
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Kernel versus user time per test')
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin,
+                        help='console output of sel4test (default: stdin)')
+    parser.add_argument('--sort', choices=['kernel', 'total', 'entries', 'name'], default='kernel',
+                        help='order of the tests (default: most kernel cycles first)')
+    args = parser.parse_args()
+
+    tests = list(parse(args.log))
+    if not tests:
+        print('no "SB& klog" records found, was the kernel built with CONFIG_BENCHMARK?',
+              file=sys.stderr)
+        return 1
+
+    keys = {
+        'kernel': lambda t: -t[1]['kernel_cycles'],
+        'total': lambda t: -t[1]['total_cycles'],
+        'entries': lambda t: -t[1]['entries'],
+        'name': lambda t: t[0],
+    }
+    tests.sort(key=keys[args.sort])
+
+    print('%-24s %10s %14s %12s %14s %14s %7s' % ('test', 'entries', 'kernel_cycles', 'per_entry',
+                                                 'user_cycles', 'total_cycles', 'kernel%'))
+    truncated = 0
+    for name, m in tests:
+        read = m['read']
+        per_entry = m['kernel_cycles'] // read if read else 0
+        total = m['total_cycles']
+        if total:
+            user = '%14d' % max(total - m['kernel_cycles'], 0)
+            percent = '%6.1f%%' % (100.0 * m['kernel_cycles'] / total)
+        else:
+            user = '%14s' % '-'
+            percent = '%7s' % '-'
+        mark = ''
+        if read < m['entries']:
+            # the kernel log filled up, the kernel time is a lower bound
+            mark = ' *'
+            truncated += 1
+        print('%-24s %10d %14d %12d %s %14s %s%s' % (name, m['entries'], m['kernel_cycles'], per_entry,
+                                                     user, total or '-', percent, mark))
+
+    if truncated:
+        print('\n* the kernel log was full, kernel cycles only cover the entries read')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,144 @@
+#!/usr/bin/env python
+#
+# Copyright 2014, NICTA
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(NICTA_BSD)
+#
+
+#
+# Boot an image many times and merge the benchmark results of every boot.
+# One boot is one sample of everything that depends on the boot: where the
+# ELF loader left things in the caches and TLB, how the timers calibrated,
+# and so on. Run from the top of the project, after building:
+#
+#   multiboot.py simulate-ia32 --boots 20 --out runs/ia32
+#
+# The qemu command is taken from the given target of the Makefile (any of
+# the simulate-* targets or run-nographics), so the boots run exactly as
+# "make <target>" would. Each boot's console output is kept in the output
+# directory as boot-<n>.log, and a boot ends when sel4test prints its
+# verdict, or is killed after --timeout seconds. The SB& records of all the
+# boots are then summarised per benchmark point with sblog.py, and the logs
+# can be given to bench-gate.py as they are.
+#
+
+from __future__ import print_function
+
+import sys
+import os
+import io
+import time
+import signal
+import argparse
+import itertools
+from subprocess import Popen, PIPE, STDOUT
+
+import sblog
+
+# the last words of sel4test
+END_MARKERS = ['All is well in the universe', '*** FAILURES DETECTED ***']
+
+
+def target_command(target, make):
+    """The shell command that "make target" runs"""
+    proc = Popen([make, '-s', '-n', target], stdout=PIPE, universal_newlines=True)
+    output, _ = proc.communicate()
+    if proc.returncode != 0:
+        return None
+    command = output.replace('\\\n', ' ').strip()
+    return command or None
+
+
+def boot(command, log_filename, timeout, markers):
+    """Run command with its output going to log_filename until it prints one
+    of markers, exits, or runs for timeout seconds. Returns the marker seen,
+    'exited' or 'timeout'."""
+    with open(log_filename, 'wb') as log, open(os.devnull, 'rb') as devnull:
+        # in a session of its own, so the shell and qemu can be killed together
+        proc = Popen(command, shell=True, stdin=devnull, stdout=log, stderr=STDOUT,
+                     preexec_fn=os.setsid)
+
+    result = 'timeout'
+    deadline = time.time() + timeout
+    tail = ''
+    # io.open, as python 2 files can stay at EOF once they have seen it
+    with io.open(log_filename, 'rb') as log:
+        while time.time() < deadline:
+            exited = proc.poll() is not None
+            # keep the end of the last read, in case a marker straddles reads
+            tail = tail[-64:] + log.read().decode('latin-1')
+            seen = [m for m in markers if m in tail]
+            if seen:
+                result = seen[0]
+                break
+            if exited:
+                result = 'exited'
+                break
+            time.sleep(0.2)
+
+    if proc.poll() is None:
+        try:
+            os.killpg(proc.pid, signal.SIGKILL)
+        except OSError:
+            pass
+        proc.wait()
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Boot an image many times and merge its benchmark results')
+    parser.add_argument('target', help='Makefile target that boots the image, e.g. simulate-ia32')
+    parser.add_argument('--boots', type=int, default=10, help='number of boots (default: %(default)s)')
+    parser.add_argument('--timeout', type=float, default=600,
+                        help='seconds before a boot is killed (default: %(default)s)')
+    parser.add_argument('--out', default='multiboot',
+                        help='directory for the console output of each boot (default: %(default)s)')
+    parser.add_argument('--end', action='append',
+                        help='output that ends a boot (may be repeated, default: the sel4test verdicts)')
+    parser.add_argument('--make', default=os.environ.get('MAKE', 'make'), help='make to use')
+    parser.add_argument('--format', choices=['csv', 'spread', 'summary'], default='summary',
+                        help='output format of the merged records, as for sblog.py (default: %(default)s)')
+    args = parser.parse_args()
+
+    command = target_command(args.target, args.make)
+    if command is None:
+        print('could not get the command of make target %s' % args.target, file=sys.stderr)
+        return 2
+    print('booting %d times: %s' % (args.boots, command), file=sys.stderr)
+
+    if not os.path.isdir(args.out):
+        os.makedirs(args.out)
+
+    markers = args.end or END_MARKERS
+    logs = []
+    results = {}
+    for n in range(args.boots):
+        log_filename = os.path.join(args.out, 'boot-%03d.log' % n)
+        start = time.time()
+        result = boot(command, log_filename, args.timeout, markers)
+        print('boot %d: %s after %.0fs' % (n, result, time.time() - start), file=sys.stderr)
+        results[result] = results.get(result, 0) + 1
+        logs.append(log_filename)
+
+    print('%d boots: %s' % (args.boots, ', '.join('%d %s' % (c, r) for r, c in sorted(results.items()))),
+          file=sys.stderr)
+
+    # a boot that timed out may still have finished some benchmarks
+    recs = sblog.records(itertools.chain(*[io.open(log, encoding='latin-1') for log in logs]))
+    if args.format == 'csv':
+        sblog.write_csv(recs, sys.stdout)
+    elif args.format == 'spread':
+        sblog.write_spread(recs, sys.stdout, None)
+    else:
+        sblog.write_summary(recs, sys.stdout)
+
+    # fail unless every boot ended with the first marker
+    return 0 if results.get(markers[0], 0) == args.boots else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -9,5 +9,9 @@
 # @TAG(NICTA_BSD)
 #
 
-exec ./clean-log.sh "$@" | ./match-data.pl | ./generate-spread.pl
-
+# the IPC benchmark: after the calibration loop, each set sweeps the priority
+# of the first thread, the direction of the call and the message length, and
+# every sample is 10000 runs
+exec ./sblog.py --format spread --sweep prio=98.. --sweep 'dir=->,<-' --sweep length=0..10 \
+    --iterations 10000 --overhead measure_bench_overhead \
+    --label '{prio} {dir} 100, Length {length}' "$@"
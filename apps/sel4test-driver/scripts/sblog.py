@@ -0,0 +1,363 @@
+#!/usr/bin/env python
+#
+# Copyright 2014, NICTA
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(NICTA_BSD)
+#
+
+#
+# Single pass parser for the "SB&" lines of sel4test output. It reads the log
+# once, line by line, and keeps no samples, so memory does not grow with the
+# log. Two kinds of line are understood:
+#
+#   SB& <benchmark> <param>=<value> ... : <metric>=<value> ...
+#
+# as printed by bench_report in sel4test-tests, and the older per sample
+# lines of the IPC benchmark
+#
+#   SB&#Sample, Cycles, PMC0, PMC1, FN Mode, FN Name, FN line, Extra
+#   SB& <n>/<total> - <cycles>, <pmc0>, <pmc1>, <enter|exit>, <function>, ...
+#
+# For the latter, every exit is paired with the enter of the same function,
+# giving one record per function with the metrics CCNT, PMC0 and PMC1. A
+# point ends when a function is seen a second time, and the points of each
+# set walk through the sweep described with --sweep, outermost dimension
+# first. The IPC sweep that parselog.sh and csvify.sh describe is
+#
+#   --sweep prio=98.. --sweep 'dir=->,<-' --sweep length=0..10
+#
+# Values are a comma separated list, or a range "first..last". Only the
+# outermost dimension may leave the range open.
+#
+# sblog.py [--format csv|spread|summary] [--csv FILE] [--sweep ...] [log ...]
+#
+# Other scripts can import this one and use records() directly.
+#
+
+from __future__ import print_function
+
+import sys
+import re
+import math
+import argparse
+import itertools
+
+PREFIX = 'SB&'
+LEGACY_HEADER = 'SB&#Sample'
+LEGACY_SAMPLE = re.compile(r'^SB&\s*(\d+)/(\d+)\s+-\s+(\d+), (\d+), (\d+), (\w+), (\w+),')
+LEGACY_METRICS = ('CCNT', 'PMC0', 'PMC1')
+
+
+class Record(object):
+    """One benchmark point. point is the parameters as printed, metrics a
+    list of (name, value) pairs in the order they were printed."""
+
+    __slots__ = ('bench', 'point', 'metrics')
+
+    def __init__(self, bench, point, metrics):
+        self.bench = bench
+        self.point = point
+        self.metrics = metrics
+
+    @property
+    def params(self):
+        """The parameters as a list of (name, value) pairs"""
+        return parse_pairs(self.point)
+
+
+class Dimension(object):
+    def __init__(self, spec):
+        name, sep, values = spec.partition('=')
+        if not sep or not name:
+            raise ValueError('sweep dimension must look like name=values: %s' % spec)
+        self.name = name
+        self.values = None
+        self.first = None
+        if '..' in values and ',' not in values:
+            first, _, last = values.partition('..')
+            self.first = int(first)
+            if last:
+                self.values = [str(v) for v in range(self.first, int(last) + 1)]
+        else:
+            self.values = values.split(',')
+
+
+class Sweep(object):
+    """Maps the index of a point within a set to its parameters"""
+
+    def __init__(self, specs):
+        self.dims = [Dimension(s) for s in specs]
+        self.points = {}
+        for d in self.dims[1:]:
+            if d.values is None:
+                raise ValueError('only the outermost dimension can be open: %s' % d.name)
+
+    def point(self, index):
+        if index not in self.points:
+            self.points[index] = ' '.join('%s=%s' % p for p in self.params(index))
+        return self.points[index]
+
+    def params(self, index):
+        if not self.dims:
+            return [('point', str(index))]
+        params = []
+        for d in reversed(self.dims):
+            if d.values is None:
+                params.append((d.name, str(d.first + index)))
+            else:
+                params.append((d.name, d.values[index % len(d.values)]))
+                index //= len(d.values)
+        params.reverse()
+        return params
+
+
+def parse_pairs(text):
+    pairs = []
+    for pair in text.split():
+        key, sep, value = pair.partition('=')
+        if sep:
+            pairs.append((key, value))
+    return pairs
+
+
+def records(lines, sweep=None, iterations=1, overhead=None):
+    """Yield a Record for every benchmark point in lines.
+
+    Legacy samples are turned into records through sweep. Their metrics are
+    divided by iterations, after subtracting twice the per iteration cost of
+    the overhead function (the calibration loop), as generate-spread.pl did.
+    """
+    if sweep is None:
+        sweep = Sweep([])
+    started = {}
+    seen = set()
+    index = 0
+    cost = None
+
+    for line in lines:
+        start = line.find(PREFIX)
+        if start < 0:
+            continue
+        if start > 0:
+            line = line[start:]
+
+        # benchmark names start with a letter, legacy lines don't
+        first = line[4:5] if line[3:4] == ' ' else line[3:4]
+        if first == '#':
+            if line.startswith(LEGACY_HEADER):
+                started.clear()
+                seen.clear()
+                index = 0
+            continue
+
+        if first.isdigit():
+            sample = LEGACY_SAMPLE.match(line)
+            if sample is None:
+                continue
+            mode, func = sample.group(6), sample.group(7)
+            values = [int(sample.group(i)) for i in (3, 4, 5)]
+            if mode == 'enter':
+                started[func] = values
+                continue
+            if mode != 'exit':
+                continue
+            begin = started.pop(func, None)
+            if begin is None:
+                print('exit of %s that never started, ignored' % func, file=sys.stderr)
+                continue
+            values = [(end - b) % (1 << 32) for end, b in zip(values, begin)]
+
+            if func == overhead:
+                cost = [v // iterations for v in values]
+                continue
+            if cost is not None:
+                values = [v - 2 * c for v, c in zip(values, cost)]
+            values = [int(v / float(iterations)) for v in values]
+
+            if func in seen:
+                seen.clear()
+                index += 1
+            seen.add(func)
+            yield Record(func, sweep.point(index), list(zip(LEGACY_METRICS, values)))
+            continue
+
+        head, sep, tail = line.partition(' : ')
+        if not sep:
+            continue
+        fields = head[len(PREFIX):].split(None, 1)
+        if not fields:
+            continue
+        bench = fields[0]
+        point = fields[1].strip() if len(fields) > 1 else ''
+        metrics = []
+        for pair in tail.split():
+            key, _, value = pair.partition('=')
+            try:
+                metrics.append((key, int(value)))
+            except ValueError:
+                continue
+        yield Record(bench, point, metrics)
+
+
+class Summary(object):
+    """Running count, min, max, mean and variance (Welford's method)"""
+
+    __slots__ = ('n', 'min', 'max', 'mean', 'm2')
+
+    def __init__(self):
+        self.n = 0
+        self.min = None
+        self.max = None
+        self.mean = 0.0
+        self.m2 = 0.0
+
+    def add(self, value):
+        self.n += 1
+        if self.min is None or value < self.min:
+            self.min = value
+        if self.max is None or value > self.max:
+            self.max = value
+        delta = value - self.mean
+        self.mean += delta / self.n
+        self.m2 += delta * (value - self.mean)
+
+    def stddev(self):
+        return math.sqrt(self.m2 / (self.n - 1)) if self.n > 1 else 0.0
+
+
+class CsvWriter(object):
+    """Writes records as CSV rows. A new shape of record starts a new table,
+    with its own header."""
+
+    def __init__(self, out):
+        self.out = out
+        self.columns = None
+
+    def write(self, r):
+        params = r.params
+        names = [k for k, _ in params] + [k for k, _ in r.metrics]
+        if names != self.columns:
+            if self.columns is not None:
+                print(file=self.out)
+            self.columns = names
+            print(','.join(['bench'] + names), file=self.out)
+        print(','.join([r.bench] + [v for _, v in params] + [str(v) for _, v in r.metrics]),
+              file=self.out)
+
+
+def write_csv(recs, out):
+    writer = CsvWriter(out)
+    for r in recs:
+        writer.write(r)
+
+
+def tee_csv(recs, out):
+    """Pass recs through, writing each one to out as CSV on the way, so the
+    CSV and another output come from the same pass over the logs"""
+    writer = CsvWriter(out)
+    for r in recs:
+        writer.write(r)
+        yield r
+
+
+def write_spread(recs, out, label):
+    point = None
+    for r in recs:
+        this = r.point
+        if label:
+            try:
+                this = label.format(**dict(r.params))
+            except KeyError:
+                # a record from outside the sweep
+                pass
+        if this != point:
+            point = this
+            print('\n%s:' % point, file=out)
+        print('    %s:' % r.bench, file=out)
+        for key, value in r.metrics:
+            print('        %s: %d' % (key, value), file=out)
+
+
+def summarise(recs):
+    """Summaries of every metric of every benchmark point in recs. Returns
+    the points in order of first appearance, and for each point its metrics
+    in order and a Summary per metric."""
+    table = {}
+    order = []
+    for r in recs:
+        key = (r.bench, r.point)
+        entry = table.get(key)
+        if entry is None:
+            entry = table[key] = ([], {})
+            order.append(key)
+        metrics, sums = entry
+        for metric, value in r.metrics:
+            if metric not in sums:
+                metrics.append(metric)
+                sums[metric] = Summary()
+            sums[metric].add(value)
+    return order, table
+
+
+def write_summary(recs, out):
+    order, table = summarise(recs)
+    print('%-16s %-40s %-14s %7s %12s %14s %12s %12s' % ('bench', 'point', 'metric', 'n', 'min',
+                                                         'mean', 'max', 'stddev'), file=out)
+    for key in order:
+        metrics, sums = table[key]
+        for metric in metrics:
+            s = sums[metric]
+            print('%-16s %-40s %-14s %7d %12d %14.1f %12d %12.1f' % (key + (metric, s.n, s.min, s.mean,
+                                                                            s.max, s.stddev())), file=out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Parse the SB& benchmark records of sel4test logs')
+    parser.add_argument('logs', nargs='*', help='console output of sel4test (default: stdin)')
+    parser.add_argument('--format', choices=['csv', 'spread', 'summary'], default='summary',
+                        help='one CSV row per record, records grouped by point, or statistics '
+                        'per benchmark point over all runs in the logs (default)')
+    parser.add_argument('--csv', metavar='FILE',
+                        help='also write one CSV row per record to FILE, in the same pass')
+    parser.add_argument('--bench', action='append',
+                        help='only this benchmark (may be repeated, default: all)')
+    parser.add_argument('--sweep', action='append', default=[], metavar='NAME=VALUES',
+                        help='dimension of the sweep of legacy samples, outermost first')
+    parser.add_argument('--iterations', type=int, default=1,
+                        help='iterations in each legacy sample, to get the cost of one')
+    parser.add_argument('--overhead', metavar='FUNCTION',
+                        help='legacy function that measures the benchmark overhead')
+    parser.add_argument('--label', help='format of the point headers of --format spread, '
+                        'e.g. "{prio} {dir} 100, Length {length}"')
+    args = parser.parse_args()
+
+    try:
+        sweep = Sweep(args.sweep)
+    except ValueError as e:
+        parser.error(str(e))
+
+    logs = [open(log) for log in args.logs] or [sys.stdin]
+    recs = records(itertools.chain(*logs), sweep, args.iterations, args.overhead)
+    if args.bench:
+        recs = (r for r in recs if r.bench in args.bench)
+    csv = open(args.csv, 'w') if args.csv else None
+    if csv:
+        recs = tee_csv(recs, csv)
+
+    if args.format == 'csv':
+        write_csv(recs, sys.stdout)
+    elif args.format == 'spread':
+        write_spread(recs, sys.stdout, args.label)
+    else:
+        write_summary(recs, sys.stdout)
+    if csv:
+        csv.close()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
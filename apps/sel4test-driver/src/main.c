@@ -22,11 +22,14 @@
 
 #include <platsupport/timer.h>
 
+#include <sel4/messages.h>
+
 #include <sel4platsupport/platsupport.h>
 #include <sel4platsupport/plat/timer.h>
 #include <sel4utils/vspace.h>
 #include <sel4utils/stack.h>
 #include <sel4utils/process.h>
+#include <sel4utils/mapping.h>
 
 #include <simple/simple.h>
 #ifdef CONFIG_KERNEL_STABLE
@@ -42,6 +45,8 @@
 
 #include <vspace/vspace.h>
 
+#include <pmu.h>
+
 #include "test.h"
 
 struct env {
@@ -95,6 +100,18 @@ static vka_object_t untypeds[CONFIG_MAX_NUM_BOOTINFO_UNTYPED_CAPS];
 /* list of sizes (in bits) corresponding to untyped */
 static uint8_t untyped_size_bits_list[CONFIG_MAX_NUM_BOOTINFO_UNTYPED_CAPS];
 
+/* max pages of the test process we copy on write, over all of its forks */
+#define COW_MAX_PAGES 256
+/* copies of the test process' pages, mapped in place of the originals.
+ * A page copied more than once has its latest copy last. */
+static int num_cow_pages;
+static seL4_Word cow_vaddrs[COW_MAX_PAGES];
+static vka_object_t cow_frames[COW_MAX_PAGES];
+/* index of the first page copied since the test last forked, and whether
+ * it has forked at all */
+static int cow_first_page;
+static bool cow_armed;
+
 
 /*
  * Test cases are defined in test_cases.c, an autogenerated
@@ -103,6 +120,11 @@ static uint8_t untyped_size_bits_list[CONFIG_MAX_NUM_BOOTINFO_UNTYPED_CAPS];
  */
 extern testcase_t *test_cases[];
 
+/* Tests left out by TEST_PREFIX. They are not in the list above, so
+ * sel4test_run_tests neither runs nor counts them. */
+extern const char *skipped_test_names[];
+extern const int num_skipped_tests;
+
 /* initialise our runtime environment */
 static void
 init_env(env_t env)
@@ -260,6 +282,254 @@ copy_timer_caps(test_init_data_t *init, env_t env, sel4utils_process_t *test_pro
 #endif
 }
 
+/* copy the frames backing the elf regions, so the test process can share them
+ * with its helper processes rather than cloning them */
+static void
+copy_elf_region_frames(test_init_data_t *init, sel4utils_process_t *test_process)
+{
+    for (int i = 0; i < init->num_elf_regions; i++) {
+        sel4utils_elf_region_t *region = &init->elf_regions[i];
+        seL4_SlotRegion *frames = &init->elf_region_frames[i];
+
+        frames->start = frames->end = 0;
+        uintptr_t start = ROUND_DOWN((uintptr_t) region->elf_vstart, PAGE_SIZE_4K);
+        uintptr_t end = ROUND_UP((uintptr_t) region->elf_vstart + region->size, PAGE_SIZE_4K);
+        for (uintptr_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE_4K) {
+            cspacepath_t path;
+            seL4_CPtr cap = vspace_get_cap(&test_process->vspace, (void *) vaddr);
+            assert(cap != seL4_CapNull);
+            vka_cspace_make_path(&env.vka, cap, &path);
+
+            seL4_CPtr slot = sel4utils_mint_cap_to_process(test_process, path, seL4_CanRead, seL4_NilData);
+            assert(slot != 0);
+            if (vaddr == start) {
+                frames->start = slot;
+            }
+            /* slots in the process are handed out in order */
+            assert(slot == frames->start + (vaddr - start) / PAGE_SIZE_4K);
+            frames->end = slot + 1;
+        }
+    }
+}
+
+/* index of the writable elf region of the test process holding vaddr, or -1 */
+static int
+find_writable_region(test_init_data_t *init, seL4_Word vaddr)
+{
+    for (int i = 0; i < init->num_elf_regions; i++) {
+        sel4utils_elf_region_t *region = &init->elf_regions[i];
+        uintptr_t start = ROUND_DOWN((uintptr_t) region->elf_vstart, PAGE_SIZE_4K);
+        if ((region->rights & seL4_CanWrite) && vaddr >= start &&
+                vaddr < (uintptr_t) region->elf_vstart + region->size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* the cap to the frame currently mapped at vaddr in the test process */
+static seL4_CPtr
+get_test_page_cap(sel4utils_process_t *test_process, seL4_Word vaddr)
+{
+    for (int i = num_cow_pages - 1; i >= 0; i--) {
+        if (cow_vaddrs[i] == vaddr) {
+            return cow_frames[i].cptr;
+        }
+    }
+    return vspace_get_cap(&test_process->vspace, (void *) vaddr);
+}
+
+/* Remap every writable page of the test process read only, so that its
+ * next write to each is copied. The test asks for this once it has shared
+ * its frames with a fork (see create_helper_fork in sel4test-tests), which
+ * keeps the frames it had, as they were. */
+static void
+protect_test_pages(test_init_data_t *init, sel4utils_process_t *test_process)
+{
+    UNUSED int error;
+
+    for (int i = 0; i < init->num_elf_regions; i++) {
+        sel4utils_elf_region_t *region = &init->elf_regions[i];
+        if (!(region->rights & seL4_CanWrite)) {
+            continue;
+        }
+        uintptr_t start = ROUND_DOWN((uintptr_t) region->elf_vstart, PAGE_SIZE_4K);
+        uintptr_t end = ROUND_UP((uintptr_t) region->elf_vstart + region->size, PAGE_SIZE_4K);
+        for (uintptr_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE_4K) {
+            seL4_CPtr cap = get_test_page_cap(test_process, vaddr);
+            error = seL4_ARCH_Page_Unmap(cap);
+            assert(error == seL4_NoError);
+            error = seL4_ARCH_Page_Map(cap, test_process->pd.cptr, vaddr, seL4_CanRead,
+                                       seL4_ARCH_Default_VMAttributes);
+            assert(error == seL4_NoError);
+        }
+    }
+
+    cow_first_page = num_cow_pages;
+    cow_armed = true;
+}
+
+/* Handle a write by the test process to a page protected by
+ * protect_test_pages: map a writable copy of the page in its place, and
+ * give the test the copy's cap in place of the original's, so its next
+ * fork shares the copy. Returns -1 if this is a real fault. */
+static int
+copy_test_page(test_init_data_t *init, sel4utils_process_t *test_process, seL4_Word fault_addr)
+{
+    UNUSED int error;
+    seL4_Word vaddr = ROUND_DOWN(fault_addr, PAGE_SIZE_4K);
+    int region = find_writable_region(init, vaddr);
+
+    if (!cow_armed || region == -1 || num_cow_pages == COW_MAX_PAGES) {
+        return -1;
+    }
+    for (int i = cow_first_page; i < num_cow_pages; i++) {
+        if (cow_vaddrs[i] == vaddr) {
+            /* already copied and writable, this is a real fault */
+            return -1;
+        }
+    }
+
+    /* the original is mapped in the test process, so map a copy of its cap */
+    cspacepath_t original, original_copy;
+    vka_cspace_make_path(&env.vka, get_test_page_cap(test_process, vaddr), &original);
+    error = vka_cspace_alloc_path(&env.vka, &original_copy);
+    assert(error == 0);
+    error = vka_cnode_copy(&original_copy, &original, seL4_CanRead);
+    assert(error == 0);
+
+    vka_object_t *frame = &cow_frames[num_cow_pages];
+    error = vka_alloc_frame(&env.vka, PAGE_BITS_4K, frame);
+    assert(error == 0);
+
+    void *src = vspace_map_pages(&env.vspace, &original_copy.capPtr, NULL, seL4_CanRead, 1, PAGE_BITS_4K, 1);
+    void *dest = vspace_map_pages(&env.vspace, &frame->cptr, NULL, seL4_AllRights, 1, PAGE_BITS_4K, 1);
+    assert(src != NULL && dest != NULL);
+    memcpy(dest, src, PAGE_SIZE_4K);
+    vspace_unmap_pages(&env.vspace, src, 1, PAGE_BITS_4K, NULL);
+    vspace_unmap_pages(&env.vspace, dest, 1, PAGE_BITS_4K, NULL);
+    vka_cnode_delete(&original_copy);
+    vka_cspace_free(&env.vka, original_copy.capPtr);
+
+    /* swap the original for the copy. The original stays with whichever forks share it */
+    error = seL4_ARCH_Page_Unmap(original.capPtr);
+    assert(error == seL4_NoError);
+    error = seL4_ARCH_Page_Map(frame->cptr, test_process->pd.cptr, vaddr, seL4_AllRights,
+                               seL4_ARCH_Default_VMAttributes);
+    assert(error == seL4_NoError);
+
+    uintptr_t start = ROUND_DOWN((uintptr_t) init->elf_regions[region].elf_vstart, PAGE_SIZE_4K);
+    cspacepath_t copy, test_slot = {
+        .root = test_process->cspace.cptr,
+        .capPtr = init->elf_region_frames[region].start + (vaddr - start) / PAGE_SIZE_4K,
+        .capDepth = test_process->cspace_size,
+    };
+    vka_cspace_make_path(&env.vka, frame->cptr, &copy);
+    error = vka_cnode_delete(&test_slot);
+    assert(error == 0);
+    error = vka_cnode_copy(&test_slot, &copy, seL4_CanRead);
+    assert(error == 0);
+
+    cow_vaddrs[num_cow_pages] = vaddr;
+    num_cow_pages++;
+    return 0;
+}
+
+/* Handle a message from the test process that is part of forking a helper,
+ * returning false for any other message */
+static bool
+handle_fork_message(test_init_data_t *init, sel4utils_process_t *test_process, seL4_MessageInfo_t info)
+{
+    switch (seL4_MessageInfo_get_label(info)) {
+    case TEST_FORK_LABEL:
+        protect_test_pages(init, test_process);
+        return true;
+    case SEL4_PFIPC_LABEL:
+        return copy_test_page(init, test_process, seL4_GetMR(SEL4_PFIPC_FAULT_ADDR)) == 0;
+    default:
+        return false;
+    }
+}
+
+/* free the page copies of a test process, once it is destroyed */
+static void
+free_test_page_copies(void)
+{
+    for (int i = 0; i < num_cow_pages; i++) {
+        vka_free_object(&env.vka, &cow_frames[i]);
+    }
+    num_cow_pages = 0;
+    cow_first_page = 0;
+    cow_armed = false;
+}
+
+/* Tests with a performance budget report how long they took. Going over
+ * budget fails the test if CONFIG_TEST_BUDGET_FAIL is set, otherwise it
+ * is only reported. */
+static int
+check_budget(struct testcase *test, int result, seL4_Word duration_us, seL4_Word budget_us)
+{
+    if (duration_us <= budget_us) {
+        return result;
+    }
+
+    printf("%s took %u us, over its budget of %u us\n", test->name, duration_us, budget_us);
+#ifdef CONFIG_TEST_BUDGET_FAIL
+    return FAILURE;
+#else
+    return result;
+#endif
+}
+
+#ifdef CONFIG_BENCHMARK
+/* The benchmarking kernel logs the cycles spent in each kernel entry, and
+ * seL4_BenchmarkDumpLog copies up to this many entries at a time into the
+ * start of our IPC buffer. */
+#define KERNEL_LOG_CHUNK seL4_MsgMaxLength
+
+/* Report the kernel entries logged while a test ran, the first entries of
+ * the log, with the cycles the whole test took (zero unless APP_SHARED_PMU
+ * is set), so that scripts/kernel-time.py can split each test's time between
+ * kernel and user.
+ * Entries past the end of the kernel's log are lost, in which case read is
+ * less than entries. */
+static void
+report_kernel_log(struct testcase *test, uint32_t entries, pmu_counts_t *elapsed)
+{
+    seL4_Word *log = (seL4_Word *) seL4_GetIPCBuffer();
+    uint32_t read = 0;
+    uint64_t kernel_cycles = 0;
+    seL4_Word max_entry_cycles = 0;
+
+    while (read < entries) {
+        uint32_t n = seL4_BenchmarkDumpLog(read, MIN(KERNEL_LOG_CHUNK, entries - read));
+        if (n == 0) {
+            break;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            kernel_cycles += log[i];
+            max_entry_cycles = MAX(max_entry_cycles, log[i]);
+        }
+        read += n;
+    }
+
+    printf("SB& klog test=%s : entries=%u read=%u kernel_cycles=%llu max_entry_cycles=%u total_cycles=%llu\n",
+           test->name + strlen("TEST_"), entries, read, kernel_cycles, max_entry_cycles, elapsed->cycles);
+}
+#endif /* CONFIG_BENCHMARK */
+
+static void
+report_skipped_tests(void)
+{
+    for (int i = 0; i < num_skipped_tests; i++) {
+        printf("  %s skipped\n", skipped_test_names[i]);
+    }
+    if (num_skipped_tests > 0) {
+        printf("%d tests skipped, not matching TEST_PREFIX \"%s\"\n", num_skipped_tests,
+               CONFIG_TEST_PREFIX);
+    }
+}
+
 /* Run a single test.
  * Each test is launched as its own process. */
 int
@@ -289,6 +559,7 @@ run_test(struct testcase *test)
     /* setup data about untypeds */
     env.init->untypeds = copy_untypeds_to_process(&test_process, untypeds, num_untypeds);
     copy_timer_caps(env.init, &env, &test_process);
+    copy_elf_region_frames(env.init, &test_process);
     /* copy the fault endpoint - we wait on the endpoint for a message
      * or a fault to see when the test finishes */
     seL4_CPtr endpoint = copy_cap_to_process(&test_process, test_process.fault_endpoint.cptr);
@@ -313,6 +584,12 @@ run_test(struct testcase *test)
     char *argv[] = {sel4test_name, zero_string, endpoint_string};
     argv[0] = endpoint_string;
     snprintf(endpoint_string, 10, "%d", endpoint);
+#ifdef CONFIG_BENCHMARK
+    pmu_counts_t test_start, test_end, test_elapsed;
+    seL4_BenchmarkResetLog();
+    pmu_read(&test_start);
+#endif /* CONFIG_BENCHMARK */
+
     /* spawn the process */
     error = sel4utils_spawn_process_v(&test_process, &env.vka, &env.vspace,
                             ARRAY_SIZE(argv), argv, 1);
@@ -321,16 +598,36 @@ run_test(struct testcase *test)
     /* send env.init_data to the new process */
     void *remote_vaddr = send_init_data(&env, test_process.fault_endpoint.cptr, &test_process);
 
-    /* wait on it to finish or fault, report result */
+    /* wait on it to finish or fault, report result. Tests that fork helpers
+     * also call us to protect their pages, then fault on writing to them */
     seL4_Word badge;
     seL4_MessageInfo_t info = seL4_Wait(test_process.fault_endpoint.cptr, &badge);
+    while (handle_fork_message(env.init, &test_process, info)) {
+        info = seL4_ReplyWait(test_process.fault_endpoint.cptr, seL4_MessageInfo_new(0, 0, 0, 0), &badge);
+    }
+
+#ifdef CONFIG_BENCHMARK
+    /* stop counting before we print anything */
+    pmu_read(&test_end);
+    uint32_t log_entries = seL4_BenchmarkLogSize();
+#endif /* CONFIG_BENCHMARK */
 
     int result = seL4_GetMR(0);
     if (seL4_MessageInfo_get_label(info) != seL4_NoFault) {
         sel4utils_print_fault_message(info, test->name);
         result = FAILURE;
+    } else if (seL4_MessageInfo_get_length(info) >= TEST_RESULT_BUDGET_LENGTH) {
+        result = check_budget(test, result, seL4_GetMR(TEST_RESULT_DURATION_US),
+                              seL4_GetMR(TEST_RESULT_BUDGET_US));
     }
 
+#ifdef CONFIG_BENCHMARK
+    /* the log is dumped into our IPC buffer, so only once we are done with
+     * the message from the test */
+    pmu_diff(&test_start, &test_end, &test_elapsed);
+    report_kernel_log(test, log_entries, &test_elapsed);
+#endif /* CONFIG_BENCHMARK */
+
     /* unmap the env.init data frame */
     vspace_unmap_pages(&test_process.vspace, remote_vaddr, 1, PAGE_BITS_4K, NULL);
 
@@ -343,6 +640,7 @@ run_test(struct testcase *test)
 
     /* destroy the process */
     sel4utils_destroy_process(&test_process, &env.vka);
+    free_test_page_copies();
 
     test_assert(result == SUCCESS);
     return result;
@@ -426,7 +724,13 @@ void *main_continued(void *arg UNUSED)
     /* setup init data that won't change test-to-test */
     env.init->priority = seL4_MaxPrio - 1;
 
+#ifdef CONFIG_BENCHMARK
+    /* to time each test against the kernel log */
+    pmu_init();
+#endif /* CONFIG_BENCHMARK */
+
     /* now run the tests */
+    report_skipped_tests();
     sel4test_run_tests("sel4test", run_test);
 
     return NULL;
@@ -27,6 +27,19 @@
  * has new loadable sections added */
 #define MAX_REGIONS 4
 
+/* The test process reports its result to the driver in MR0. Tests with a
+ * performance budget also report how long they took, and their budget,
+ * both in microseconds. */
+#define TEST_RESULT               0
+#define TEST_RESULT_DURATION_US   1
+#define TEST_RESULT_BUDGET_US     2
+#define TEST_RESULT_BUDGET_LENGTH 3
+
+/* Label of the seL4_Call the test process makes to the driver once it has
+ * shared its frames with a fork. The driver remaps the writable elf regions
+ * read only, and copies a page on the next write fault to it. */
+#define TEST_FORK_LABEL 0x100
+
 /* data shared between sel4test-driver and the sel4test-tests app.
  * all caps are in the sel4test-tests process' cspace */
 typedef struct {
@@ -81,6 +94,12 @@ typedef struct {
 
     /* the number of elf regions */
     int num_elf_regions;
+
+    /* Caps to the frames backing each elf region, one per 4K page in
+     * order. Copies can map these read only instead of cloning the region.
+     * The driver keeps them pointing at the current frame of each page when
+     * it copies pages after a TEST_FORK_LABEL call. */
+    seL4_SlotRegion elf_region_frames[MAX_REGIONS];
 } test_init_data_t;
 
 #endif /* __TEST_H */
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2014, NICTA
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(NICTA_BSD)
+ */
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <autoconf.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <platsupport/timer.h>
+#ifdef CONFIG_ARCH_IA32
+#include <platsupport/arch/tsc.h>
+#endif
+
+#include "helpers.h"
+
+/* Timestamps are in cycles where we have a cycle counter readable from user
+ * level (the TSC on ia32) and in nanoseconds from the default timer otherwise.
+ * Use bench_ticks_per_second to convert.
+ *
+ * With APP_TESTS_BENCH_ICOUNT we are run under QEMU with -icount shift=0 (see
+ * the *-icount targets in the top level Makefile), where the guest's clocks
+ * advance by one nanosecond for every instruction executed. Ticks are then
+ * instruction counts, the same on every run of the same build, and records
+ * are marked clock=icount so they are never compared with timed runs. */
+typedef uint64_t bench_ticks_t;
+
+static inline bench_ticks_t
+bench_now(env_t env)
+{
+#ifdef CONFIG_ARCH_IA32
+    return rdtsc_pure();
+#else
+    return timer_get_time(env->timer->timer);
+#endif
+}
+
+/* Calibrating the TSC takes a while, so only do it once per test process */
+static inline uint64_t
+bench_ticks_per_second(env_t env)
+{
+#if defined(CONFIG_APP_TESTS_BENCH_ICOUNT)
+    /* the TSC counts virtual nanoseconds, there is nothing to calibrate */
+    return NS_IN_S;
+#elif defined(CONFIG_ARCH_IA32)
+    static uint64_t tsc_freq = 0;
+    if (tsc_freq == 0) {
+        tsc_freq = tsc_calculate_frequency(env->timer->timer);
+    }
+    return tsc_freq;
+#else
+    return NS_IN_S;
+#endif
+}
+
+/* Number of events per second, given the number of events and the ticks
+ * they took. */
+static inline uint64_t
+bench_rate(env_t env, uint64_t events, bench_ticks_t ticks)
+{
+    if (ticks == 0) {
+        return 0;
+    }
+    return (events * bench_ticks_per_second(env)) / ticks;
+}
+
+/* Convert a number of ticks to nanoseconds. Whole seconds are taken out
+ * first, so this doesn't overflow for long runs. */
+static inline uint64_t
+bench_ticks_to_ns(env_t env, bench_ticks_t ticks)
+{
+    uint64_t freq = bench_ticks_per_second(env);
+    return (ticks / freq) * NS_IN_S + ((ticks % freq) * NS_IN_S) / freq;
+}
+
+/* Benchmark results are printed one record per line, in the form
+ *
+ *   SB& <benchmark> <param>=<value> ... : <metric>=<value> ...
+ *
+ * The params identify the benchmark point (e.g. the number of clients) and
+ * the metrics are the measured values at that point. */
+#define BENCH_PREFIX "SB& "
+
+#ifdef CONFIG_APP_TESTS_BENCH_ICOUNT
+#define BENCH_CLOCK_PARAM "clock=icount "
+#else
+#define BENCH_CLOCK_PARAM ""
+#endif
+
+#define bench_report(name, params_fmt, metrics_fmt, ...) \
+    printf(BENCH_PREFIX "%s " BENCH_CLOCK_PARAM params_fmt " : " metrics_fmt "\n", name, __VA_ARGS__)
+
+#endif /* __BENCH_H */
@@ -10,10 +10,10 @@
 
 
 #include <sel4/sel4.h>
+#include <sel4/messages.h>
 #include <sel4utils/arch/util.h>
 
 #include <sel4test/test.h>
-#include <stdarg.h>
 #include <stdlib.h>
 
 #include <utils/util.h>
@@ -187,24 +187,76 @@ are_tcbs_distinct(seL4_CPtr tcb1, seL4_CPtr tcb2)
     return 0;
 }
 
+NORETURN static void helper_thread(int argc, char **argv);
+
+static bool
+region_has_frames(env_t env, int i)
+{
+    return env->region_frames[i].end > env->region_frames[i].start;
+}
+
+static bool
+region_is_writable(sel4utils_elf_region_t *region)
+{
+    return (region->rights & seL4_CanWrite) != 0;
+}
+
+static uintptr_t
+region_start(sel4utils_elf_region_t *region)
+{
+    return ROUND_DOWN((uintptr_t) region->elf_vstart, BIT(seL4_PageBits));
+}
+
+/* map the frames of a region into the helper, read only */
 static void
-create_args(char strings[][WORD_STRING_SIZE], char *argv[], int argc, ...)
+share_region(env_t env, helper_thread_t *thread, int i)
 {
-    va_list args;
-    va_start(args, argc);
+    UNUSED int error;
+    uintptr_t vaddr = region_start(&thread->regions[i]);
 
-    for (int i = 0; i < argc; i++) {
-        seL4_Word arg = va_arg(args, seL4_Word);
-        argv[i] = strings[i];
-        snprintf(argv[i], WORD_STRING_SIZE, "%d", arg);
+    for (seL4_CPtr frame = env->region_frames[i].start; frame < env->region_frames[i].end; frame++) {
+        cspacepath_t src, dest;
+        vka_cspace_make_path(&env->vka, frame, &src);
+        error = vka_cspace_alloc_path(&env->vka, &dest);
+        assert(error == 0);
+        error = vka_cnode_copy(&dest, &src, seL4_CanRead);
+        assert(error == 0);
 
+        error = vspace_map_pages_at_vaddr(&thread->process.vspace, &dest.capPtr, NULL, (void *) vaddr,
+                                          1, seL4_PageBits, thread->regions[i].reservation);
+        assert(error == 0);
+        vaddr += BIT(seL4_PageBits);
     }
+}
 
-    va_end(args);
+/* unmap a shared region from the helper, without freeing the frames,
+ * and delete our copies of the frame caps */
+static void
+unshare_region(env_t env, helper_thread_t *thread, int i)
+{
+    uintptr_t vaddr = region_start(&thread->regions[i]);
+
+    for (seL4_CPtr frame = env->region_frames[i].start; frame < env->region_frames[i].end; frame++) {
+        cspacepath_t path;
+        seL4_CPtr cap = vspace_get_cap(&thread->process.vspace, (void *) vaddr);
+
+        /* pages copied by a fork are already gone */
+        if (cap != seL4_CapNull) {
+            vspace_unmap_pages(&thread->process.vspace, (void *) vaddr, 1, seL4_PageBits, NULL);
+            vka_cspace_make_path(&env->vka, cap, &path);
+            vka_cnode_delete(&path);
+            vka_cspace_free(&env->vka, cap);
+        }
+        vaddr += BIT(seL4_PageBits);
+    }
 }
 
-void
-create_helper_process(env_t env, helper_thread_t *thread)
+/* Create a helper process. If copy_on_write is set every region is shared
+ * with the helper read only, otherwise only read only regions are shared
+ * and the rest are cloned. */
+static void
+create_helper_process_custom(env_t env, helper_thread_t *thread, bool copy_on_write,
+                             seL4_CPtr fault_endpoint)
 {
     UNUSED int error;
 
@@ -221,7 +273,7 @@ create_helper_process(env_t env, helper_thread_t *thread)
         .reservations = env->regions,
         .num_reservations = env->num_regions,
         .create_fault_endpoint = false,
-        .fault_endpoint = { .cptr = env->endpoint },
+        .fault_endpoint = { .cptr = fault_endpoint },
         .priority = OUR_PRIO - 1,
 #ifndef CONFIG_KERNEL_STABLE
         .asid_pool = env->asid_pool,
@@ -236,16 +288,199 @@ create_helper_process(env_t env, helper_thread_t *thread)
     memcpy(thread->regions, env->regions, sizeof(sel4utils_elf_region_t) * env->num_regions);
     thread->num_regions = env->num_regions;
 
-    /* clone data/code into vspace */
+    /* share read only code/data, and clone the rest into vspace */
     for (int i = 0; i < env->num_regions; i++) {
-        error = sel4utils_bootstrap_clone_into_vspace(&env->vspace, &thread->process.vspace, thread->regions[i].reservation);
-        assert(error == 0);
+        thread->region_shared[i] = region_has_frames(env, i) &&
+                                   (copy_on_write || !region_is_writable(&thread->regions[i]));
+        if (thread->region_shared[i]) {
+            share_region(env, thread, i);
+        } else {
+            error = sel4utils_bootstrap_clone_into_vspace(&env->vspace, &thread->process.vspace, thread->regions[i].reservation);
+            assert(error == 0);
+        }
+    }
+
+    /* share a frame with the process to pass it its args */
+    thread->args = vspace_new_pages(&env->vspace, seL4_AllRights, 1, seL4_PageBits);
+    assert(thread->args != NULL);
+
+    cspacepath_t path;
+    vka_cspace_make_path(&env->vka, vspace_get_cap(&env->vspace, thread->args), &path);
+    error = vka_cspace_alloc_path(&env->vka, &thread->args_frame_copy);
+    assert(error == 0);
+    error = vka_cnode_copy(&thread->args_frame_copy, &path, seL4_AllRights);
+    assert(error == 0);
+
+    thread->remote_args = vspace_map_pages(&thread->process.vspace, &thread->args_frame_copy.capPtr,
+                                           NULL, seL4_AllRights, 1, seL4_PageBits, 1);
+    assert(thread->remote_args != NULL);
+
+    /* argv never changes, so format it once here rather than on every start.
+     * The first two args get us through the standard 'main' function and end
+     * up in helper_thread */
+    for (int i = 0; i < HELPER_PROCESS_ARGC; i++) {
+        thread->argv[i] = thread->argv_strings[i];
     }
+    snprintf(thread->argv[0], WORD_STRING_SIZE, "helper");
+    snprintf(thread->argv[1], WORD_STRING_SIZE, "%p", helper_thread);
+    snprintf(thread->argv[2], WORD_STRING_SIZE, "%p", thread->remote_args);
 
     thread->thread = thread->process.thread;
     assert(error == 0);
 }
 
+void
+create_helper_process(env_t env, helper_thread_t *thread)
+{
+    create_helper_process_custom(env, thread, false, env->endpoint);
+}
+
+/* Replace the shared frame at the faulting address in a fork with a copy of
+ * it. Our own page may have been written since the fork, so copy the frame
+ * the fork shares rather than reading the page at the same address here. */
+static int
+fork_copy_page(env_t env, helper_fork_t *fork, seL4_Word fault_addr)
+{
+    helper_thread_t *thread = &fork->helper;
+    seL4_Word vaddr = ROUND_DOWN(fault_addr, BIT(seL4_PageBits));
+    int region = -1;
+
+    for (int i = 0; i < thread->num_regions; i++) {
+        sel4utils_elf_region_t *r = &thread->regions[i];
+        if (thread->region_shared[i] && region_is_writable(r) && vaddr >= region_start(r) &&
+                vaddr < (uintptr_t) r->elf_vstart + r->size) {
+            region = i;
+        }
+    }
+    if (region == -1 || fork->num_copied == FORK_MAX_COPIED_PAGES) {
+        return -1;
+    }
+    for (int i = 0; i < fork->num_copied; i++) {
+        if (fork->copied_vaddrs[i] == vaddr) {
+            /* we already copied this page, this is a real fault */
+            return -1;
+        }
+    }
+
+    vka_object_t *frame = &fork->copied_frames[fork->num_copied];
+    int error = vka_alloc_frame(&env->vka, seL4_PageBits, frame);
+    if (error) {
+        return -1;
+    }
+
+    /* the shared frame is mapped in the fork, so map a copy of its cap */
+    cspacepath_t shared, shared_copy;
+    vka_cspace_make_path(&env->vka, vspace_get_cap(&thread->process.vspace, (void *) vaddr), &shared);
+    assert(shared.capPtr != seL4_CapNull);
+    error = vka_cspace_alloc_path(&env->vka, &shared_copy);
+    assert(error == 0);
+    error = vka_cnode_copy(&shared_copy, &shared, seL4_CanRead);
+    assert(error == 0);
+
+    void *src = vspace_map_pages(&env->vspace, &shared_copy.capPtr, NULL, seL4_CanRead, 1, seL4_PageBits, 1);
+    void *copy = vspace_map_pages(&env->vspace, &frame->cptr, NULL, seL4_AllRights, 1, seL4_PageBits, 1);
+    if (src != NULL && copy != NULL) {
+        memcpy(copy, src, BIT(seL4_PageBits));
+    }
+    if (src != NULL) {
+        vspace_unmap_pages(&env->vspace, src, 1, seL4_PageBits, NULL);
+    }
+    if (copy != NULL) {
+        vspace_unmap_pages(&env->vspace, copy, 1, seL4_PageBits, NULL);
+    }
+    vka_cnode_delete(&shared_copy);
+    vka_cspace_free(&env->vka, shared_copy.capPtr);
+    if (src == NULL || copy == NULL) {
+        vka_free_object(&env->vka, frame);
+        return -1;
+    }
+
+    /* swap the shared frame for the copy */
+    vspace_unmap_pages(&thread->process.vspace, (void *) vaddr, 1, seL4_PageBits, NULL);
+    vka_cnode_delete(&shared);
+    vka_cspace_free(&env->vka, shared.capPtr);
+
+    error = vspace_map_pages_at_vaddr(&thread->process.vspace, &frame->cptr, NULL, (void *) vaddr,
+                                      1, seL4_PageBits, thread->regions[region].reservation);
+    if (error) {
+        vka_free_object(&env->vka, frame);
+        return -1;
+    }
+
+    fork->copied_vaddrs[fork->num_copied] = vaddr;
+    fork->num_copied++;
+    return 0;
+}
+
+/* Handles faults from a fork, copying pages on its first write */
+NORETURN static void
+fork_pager(void *arg0, void *arg1)
+{
+    helper_fork_t *fork = (helper_fork_t *) arg0;
+    env_t env = (env_t) arg1;
+
+    while (1) {
+        seL4_Word badge;
+        seL4_MessageInfo_t tag = seL4_Wait(fork->pager_endpoint.cptr, &badge);
+        seL4_Word label = seL4_MessageInfo_get_label(tag);
+        seL4_Word fault_ip = seL4_GetMR(SEL4_PFIPC_FAULT_IP);
+        seL4_Word fault_addr = seL4_GetMR(SEL4_PFIPC_FAULT_ADDR);
+
+        if (label == SEL4_PFIPC_LABEL && fork_copy_page(env, fork, fault_addr) == 0) {
+            /* restart the faulting instruction */
+            seL4_Reply(seL4_MessageInfo_new(0, 0, 0, 0));
+        } else {
+            LOG_ERROR("Unhandled fault in fork: label %d, ip %p, addr %p\n", label,
+                      (void *) fault_ip, (void *) fault_addr);
+            /* the fork will never finish, so tell whoever is waiting for it
+             * that it failed */
+            seL4_SetMR(0, FAILURE);
+            seL4_Send(fork->helper.local_endpoint.cptr, seL4_MessageInfo_new(0, 0, 0, 1));
+        }
+    }
+}
+
+void
+create_helper_fork(env_t env, helper_fork_t *fork)
+{
+    UNUSED int error;
+
+    fork->num_copied = 0;
+    error = vka_alloc_endpoint(&env->vka, &fork->pager_endpoint);
+    assert(error == 0);
+
+    create_helper_process_custom(env, &fork->helper, true, fork->pager_endpoint.cptr);
+
+    /* the pager runs at our priority, so it handles faults as soon as they happen */
+    seL4_CapData_t data = seL4_CapData_Guard_new(0, seL4_WordBits - env->cspace_size_bits);
+    error = sel4utils_configure_thread(&env->vka, &env->vspace, &env->vspace, env->endpoint,
+                                       OUR_PRIO, env->cspace_root, data, &fork->pager);
+    assert(error == 0);
+    error = sel4utils_start_thread(&fork->pager, fork_pager, (void *) fork, (void *) env, 1);
+    assert(error == 0);
+
+    /* The fork now shares our frames. Have the driver make our own mappings
+     * of them read only, so that we write to copies and the fork keeps the
+     * frames as they are now. */
+    seL4_Call(env->endpoint, seL4_MessageInfo_new(TEST_FORK_LABEL, 0, 0, 0));
+}
+
+void
+cleanup_helper_fork(env_t env, helper_fork_t *fork)
+{
+    /* stop the pager before touching the fork's vspace */
+    sel4utils_clean_up_thread(&env->vka, &env->vspace, &fork->pager);
+
+    for (int i = 0; i < fork->num_copied; i++) {
+        vspace_unmap_pages(&fork->helper.process.vspace, (void *) fork->copied_vaddrs[i], 1,
+                           seL4_PageBits, NULL);
+        vka_free_object(&env->vka, &fork->copied_frames[i]);
+    }
+
+    cleanup_helper(env, &fork->helper);
+    vka_free_object(&env->vka, &fork->pager_endpoint);
+}
+
 NORETURN static void
 signal_helper_finished(seL4_CPtr local_endpoint, int val)
 {
@@ -257,65 +492,77 @@ signal_helper_finished(seL4_CPtr local_endpoint, int val)
 }
 
 NORETURN static void
-helper_thread(int argc, char **argv)
+run_helper(helper_args_t *args)
 {
-
-    helper_fn_t entry_point = (void *) atoi(argv[2]);
-    seL4_CPtr local_endpoint = (seL4_CPtr) atoi(argv[3]);
-
-    seL4_Word args[HELPER_THREAD_MAX_ARGS] = {0};
-    for (int i = 4; i < argc && i - 4 < HELPER_THREAD_MAX_ARGS; i++) {
-        assert(argv[i] != NULL);
-        args[i - 4] = atoi(argv[i]);
-    }
-
     /* run the thread */
-    int result = entry_point(args[0], args[1], args[2], args[3]);
-    signal_helper_finished(local_endpoint, result);
+    int result = args->entry_point(args->args[0], args->args[1], args->args[2], args->args[3],
+                                   args->args[4], args->args[5], args->args[6], args->args[7]);
+    signal_helper_finished(args->local_endpoint, result);
     /* does not return */
 }
 
+/* entry point for helper processes, from main */
+NORETURN static void
+helper_thread(int argc, char **argv)
+{
+    assert(argc == HELPER_PROCESS_ARGC);
+    run_helper((helper_args_t *) strtoul(argv[2], NULL, 0));
+}
+
+/* entry point for helper threads */
+NORETURN static void
+helper_thread_local(void *arg0, void *arg1)
+{
+    run_helper((helper_args_t *) arg0);
+}
+
 extern uintptr_t _start[];
 extern uintptr_t sel4_vsyscall[];
 
 void
-start_helper(env_t env, helper_thread_t *thread, helper_fn_t entry_point,
-             seL4_Word arg0, seL4_Word arg1, seL4_Word arg2, seL4_Word arg3)
+start_helper_v(env_t env, helper_thread_t *thread, helper_fn_t entry_point,
+               int argc, seL4_Word *args)
 {
-
     UNUSED int error;
 
-    seL4_CPtr local_endpoint;
+    assert(argc >= 0 && argc <= HELPER_THREAD_MAX_ARGS);
 
     if (thread->is_process) {
         /* copy the local endpoint */
         cspacepath_t path;
         vka_cspace_make_path(&env->vka, thread->local_endpoint.cptr, &path);
-        local_endpoint = sel4utils_copy_cap_to_process(&thread->process, path);
+        thread->args->local_endpoint = sel4utils_copy_cap_to_process(&thread->process, path);
     } else {
-        local_endpoint = thread->local_endpoint.cptr;
+        thread->args = &thread->thread_args;
+        thread->args->local_endpoint = thread->local_endpoint.cptr;
     }
 
-    /* If we are starting a process then the first two args are to get us
-     * through the standard 'main' function and end up in helper_thread
-     * if we are starting a regular thread then these will be ignored */
-    create_args(thread->args_strings, thread->args, HELPER_THREAD_TOTAL_ARGS,
-        0, helper_thread, (seL4_Word) entry_point, local_endpoint,
-        arg0, arg1, arg2, arg3);
+    thread->args->entry_point = entry_point;
+    for (int i = 0; i < HELPER_THREAD_MAX_ARGS; i++) {
+        thread->args->args[i] = i < argc ? args[i] : 0;
+    }
 
     if (thread->is_process) {
         thread->process.entry_point = (void*)_start;
         thread->process.sysinfo = (uintptr_t)sel4_vsyscall;
         error = sel4utils_spawn_process_v(&thread->process, &env->vka, &env->vspace,
-                                        HELPER_THREAD_TOTAL_ARGS, thread->args, 1);
+                                        HELPER_PROCESS_ARGC, thread->argv, 1);
         assert(error == 0);
     } else {
-        error = sel4utils_start_thread(&thread->thread, helper_thread,
-                                       (void *) HELPER_THREAD_TOTAL_ARGS, (void *) thread->args, 1);
+        error = sel4utils_start_thread(&thread->thread, helper_thread_local,
+                                       (void *) thread->args, NULL, 1);
         assert(error == 0);
     }
 }
 
+void
+start_helper(env_t env, helper_thread_t *thread, helper_fn_t entry_point,
+             seL4_Word arg0, seL4_Word arg1, seL4_Word arg2, seL4_Word arg3)
+{
+    seL4_Word args[] = {arg0, arg1, arg2, arg3};
+    start_helper_v(env, thread, entry_point, ARRAY_SIZE(args), args);
+}
+
 void
 cleanup_helper(env_t env, helper_thread_t *thread)
 {
@@ -323,9 +570,19 @@ cleanup_helper(env_t env, helper_thread_t *thread)
     vka_free_object(&env->vka, &thread->local_endpoint);
 
     if (thread->is_process) {
-        /* free the regions (no need to unmap, as the
+        /* the args frame belongs to us, so unmap it without freeing it
+         * before the process is destroyed */
+        vspace_unmap_pages(&thread->process.vspace, thread->remote_args, 1, seL4_PageBits, NULL);
+        vka_cnode_delete(&thread->args_frame_copy);
+        vka_cspace_free(&env->vka, thread->args_frame_copy.capPtr);
+        vspace_free_pages(&env->vspace, thread->args, 1, seL4_PageBits);
+
+        /* free the regions (no need to unmap cloned regions, as the
         * entry address space / cspace is being destroyed */
         for (int i = 0; i < thread->num_regions; i++) {
+            if (thread->region_shared[i]) {
+                unshare_region(env, thread, i);
+            }
             vspace_free_reservation(&thread->process.vspace, thread->regions[i].reservation);
         }
 
@@ -22,13 +22,15 @@
 #include "test.h"
 
 #define OUR_PRIO (env->priority)
-#define WORD_STRING_SIZE 11
+/* enough for a word in hex, with a leading 0x */
+#define WORD_STRING_SIZE (2 + sizeof(seL4_Word) * 2 + 1)
 /* args provided by the user */
-#define HELPER_THREAD_MAX_ARGS 4
-/* metadata helpers adds */
-#define HELPER_THREAD_META     4
-/* total args (user + meta) */
-#define HELPER_THREAD_TOTAL_ARGS (HELPER_THREAD_MAX_ARGS + HELPER_THREAD_META)
+#define HELPER_THREAD_MAX_ARGS 8
+/* argv passed to a helper process: the process name, the helper entry
+ * in main and the address of its helper_args */
+#define HELPER_PROCESS_ARGC    3
+/* pages a fork can write to before the pager gives up on it */
+#define FORK_MAX_COPIED_PAGES  64
 
 struct env {
     /* An initialised vka that may be used by the test. */
@@ -59,11 +61,37 @@ struct env {
     int cspace_size_bits;
     int num_regions;
     sel4utils_elf_region_t regions[MAX_REGIONS];
+    /* caps to the frames of the read only regions, see test.h */
+    seL4_SlotRegion region_frames[MAX_REGIONS];
 };
 
 #include <sel4test/test.h>
 
-typedef int (*helper_fn_t)(seL4_Word, seL4_Word, seL4_Word, seL4_Word);
+/* A performance budget for a test, in microseconds. The test process times
+ * tests that have one, and the driver flags those that go over it. */
+typedef struct test_budget {
+    const char *name;
+    uint64_t budget_us;
+} test_budget_t;
+
+#define DEFINE_TEST_BUDGET(_name, _description, _function, _budget_us) \
+    DEFINE_TEST(_name, _description, _function) \
+    static test_budget_t TEST_BUDGET_##_name \
+    __attribute__((used)) __attribute__((section("_test_budget"))) = { \
+        .name = #_name, \
+        .budget_us = _budget_us, \
+    };
+
+typedef int (*helper_fn_t)(seL4_Word, seL4_Word, seL4_Word, seL4_Word,
+                           seL4_Word, seL4_Word, seL4_Word, seL4_Word);
+
+/* Arguments for a helper, passed as binary words. Threads get a pointer to
+ * this directly, processes find it in a frame shared with the parent. */
+typedef struct helper_args {
+    helper_fn_t entry_point;
+    seL4_CPtr local_endpoint;
+    seL4_Word args[HELPER_THREAD_MAX_ARGS];
+} helper_args_t;
 
 typedef struct helper_thread {
     sel4utils_elf_region_t regions[MAX_REGIONS];
@@ -76,21 +104,60 @@ typedef struct helper_thread {
 
     void *arg0;
     void *arg1;
-    char *args[HELPER_THREAD_TOTAL_ARGS];
-    char args_strings[HELPER_THREAD_TOTAL_ARGS][WORD_STRING_SIZE];
+    /* args for a thread, or the local mapping of the args frame of a process */
+    helper_args_t thread_args;
+    helper_args_t *args;
+    /* copy of the args frame cap, and its address in the process */
+    cspacepath_t args_frame_copy;
+    void *remote_args;
+    char *argv[HELPER_PROCESS_ARGC];
+    char argv_strings[HELPER_PROCESS_ARGC][WORD_STRING_SIZE];
+    /* regions mapped from our frames rather than cloned */
+    bool region_shared[MAX_REGIONS];
 
     bool is_process;
 } helper_thread_t;
 
+/* A helper process that shares all of our frames, copying them on write */
+typedef struct helper_fork {
+    helper_thread_t helper;
+
+    /* thread in our vspace that handles the fork's faults */
+    sel4utils_thread_t pager;
+    vka_object_t pager_endpoint;
+
+    /* pages that have been copied */
+    int num_copied;
+    seL4_Word copied_vaddrs[FORK_MAX_COPIED_PAGES];
+    vka_object_t copied_frames[FORK_MAX_COPIED_PAGES];
+} helper_fork_t;
+
 /* Helper thread/process functions */
 
 /* create a helper in the current vspace and current cspace */
 void create_helper_thread(env_t env, helper_thread_t *thread);
 
 /* create a helper with a clone of the current vspace loadable elf segments,
- * and a new cspace */
+ * and a new cspace. Read only segments are shared with the current vspace
+ * rather than cloned, where the driver gave us the frames to do so. */
 void create_helper_process(env_t env, helper_thread_t *thread);
 
+/* Create a helper process that shares all of the current vspace's loadable
+ * elf segments, copying writable pages on the first write to each from
+ * either side. The fork sees our globals and heap as they are when this
+ * returns, and we don't see its writes.
+ *
+ * The fork's copies are made by a pager thread that uses our vka and
+ * vspace. Ours are made by the driver, which leaves our writable pages read
+ * only until the test ends, so every page we write after forking costs a
+ * fault and a copy. The fork does not get our stack, so pass anything it
+ * needs on it as arguments.
+ *
+ * Start and wait for it with start_helper(&fork->helper...) and
+ * wait_for_helper(&fork->helper), and clean it up with cleanup_helper_fork */
+void create_helper_fork(env_t env, helper_fork_t *fork);
+void cleanup_helper_fork(env_t env, helper_fork_t *fork);
+
 /* set a helper threads priority */
 void set_helper_priority(helper_thread_t *thread, seL4_Word prio);
 
@@ -100,6 +167,11 @@ void set_helper_priority(helper_thread_t *thread, seL4_Word prio);
 void start_helper(env_t env, helper_thread_t *thread, helper_fn_t entry_point,
                   seL4_Word arg0, seL4_Word arg1, seL4_Word arg2, seL4_Word arg3);
 
+/* Start a helper with up to HELPER_THREAD_MAX_ARGS arguments. Arguments not
+ * provided are passed as 0. */
+void start_helper_v(env_t env, helper_thread_t *thread, helper_fn_t entry_point,
+                    int argc, seL4_Word *args);
+
 /* wait for a helper thread to finish */
 int wait_for_helper(helper_thread_t *thread);
 
@@ -12,6 +12,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include <allocman/vka.h>
@@ -36,6 +37,7 @@
 
 #include <vka/capops.h>
 
+#include "bench.h"
 #include "helpers.h"
 #include "test.h"
 
@@ -77,6 +79,21 @@ __arch_putchar(int c)
 #endif
 }
 
+/* defined by the linker if any test has a budget */
+extern test_budget_t __start__test_budget[] __attribute__((weak));
+extern test_budget_t __stop__test_budget[] __attribute__((weak));
+
+static test_budget_t *
+find_budget(char *name)
+{
+    for (test_budget_t *budget = __start__test_budget; budget < __stop__test_budget; budget++) {
+        if (strncmp(budget->name, name, TEST_NAME_MAX) == 0) {
+            return budget;
+        }
+    }
+    return NULL;
+}
+
 static testcase_t *
 find_test(char *name)
 {
@@ -226,7 +243,7 @@ main(int argc, char **argv)
      * main can get run multiple times. Look in src/helpers.c
      * for where this is used. Just means we check the first
      * arg, and if not NULL jmp to it */
-    void (*helper_thread)(int argc,char **argv) = (void(*)(int, char**))atoi(argv[1]);
+    void (*helper_thread)(int argc,char **argv) = (void(*)(int, char**))strtoul(argv[1], NULL, 0);
     if (helper_thread) {
         helper_thread(argc, argv);
     }
@@ -254,6 +271,7 @@ main(int argc, char **argv)
 #endif
     env.num_regions = init_data->num_elf_regions;
     memcpy(env.regions, init_data->elf_regions, sizeof(sel4utils_elf_region_t) * env.num_regions);
+    memcpy(env.region_frames, init_data->elf_region_frames, sizeof(seL4_SlotRegion) * env.num_regions);
 
     /* initialse cspace, vspace and untyped memory allocation */
     init_allocator(&env, init_data);
@@ -264,11 +282,23 @@ main(int argc, char **argv)
     /* find the test */
     testcase_t *test = find_test(init_data->name);
 
+    test_budget_t *budget = find_budget(init_data->name);
+    if (budget) {
+        /* calibrate the clock now rather than while timing the test */
+        bench_ticks_per_second(&env);
+    }
+
     /* run the test */
     int result = 0;
+    uint64_t duration_us = 0;
     if (test) {
         printf("Running test %s (%s)\n", test->name, test->description);
+        /* only tests with a budget are timed */
+        bench_ticks_t start = budget ? bench_now(&env) : 0;
         result = test->function(&env, test->args);
+        if (budget) {
+            duration_us = bench_ticks_to_ns(&env, bench_now(&env) - start) / NS_IN_US;
+        }
     } else {
         result = FAILURE;
         LOG_ERROR("Cannot find test %s\n", init_data->name);
@@ -277,7 +307,13 @@ main(int argc, char **argv)
     printf("Test %s %s\n", init_data->name, result == SUCCESS ? "passed" : "failed");
     /* send our result back */
     seL4_MessageInfo_t info = seL4_MessageInfo_new(seL4_NoFault, 0, 0, 1);
-    seL4_SetMR(0, result);
+    seL4_SetMR(TEST_RESULT, result);
+    if (budget) {
+        printf("Test %s took %llu us (budget %llu us)\n", init_data->name, duration_us, budget->budget_us);
+        info = seL4_MessageInfo_new(seL4_NoFault, 0, 0, TEST_RESULT_BUDGET_LENGTH);
+        seL4_SetMR(TEST_RESULT_DURATION_US, MIN(duration_us, (uint64_t) (seL4_Word) -1));
+        seL4_SetMR(TEST_RESULT_BUDGET_US, budget->budget_us);
+    }
     seL4_Send(endpoint, info);
 
     /* It is expected that we are torn down by the test driver before we are
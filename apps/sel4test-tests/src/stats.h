@@ -0,0 +1,257 @@
+/*
+ * Copyright 2014, NICTA
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(NICTA_BSD)
+ */
+#ifndef __STATS_H
+#define __STATS_H
+
+/* Summary statistics for benchmarks.
+ *
+ * Samples are recorded in a fixed size log-linear histogram: values below
+ * 2^STATS_SUB_BITS get a bucket each, and every power of two above that is
+ * split into 2^STATS_SUB_BITS linear buckets, so percentiles are accurate to
+ * within 1/2^STATS_SUB_BITS of the value. Nothing is allocated, so a
+ * stats_t can be recorded into from timed code. Declare them static, as they
+ * are a few KiB.
+ *
+ * The timer overhead (the ticks between two back to back bench_now calls) is
+ * measured by stats_init and subtracted from every sample. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <utils/util.h>
+
+#include "bench.h"
+
+#define STATS_SUB_BITS    4
+#define STATS_SUB_BUCKETS BIT(STATS_SUB_BITS)
+#define STATS_NUM_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+/* Times to read the timer when calibrating the overhead */
+#define STATS_CALIBRATE_ITERATIONS 1000
+
+typedef struct stats {
+    uint32_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    bench_ticks_t overhead;
+    uint32_t buckets[STATS_NUM_BUCKETS];
+} stats_t;
+
+typedef struct stats_summary {
+    uint32_t count;
+    uint64_t min;
+    uint64_t median;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+    uint64_t mean;
+    uint64_t stddev;
+    /* samples more than 3 inter quartile ranges above the upper quartile */
+    uint32_t outliers;
+    bench_ticks_t overhead;
+} stats_summary_t;
+
+/* Format and arguments for reporting a summary with bench_report, e.g.
+ *
+ *   bench_report("FOO0001", "size=%d", STATS_FMT, size, STATS_ARGS(&summary));
+ */
+#define STATS_FMT "samples=%u min=%llu median=%llu p90=%llu p99=%llu max=%llu mean=%llu stddev=%llu outliers=%u overhead=%llu"
+#define STATS_ARGS(s) (s)->count, (s)->min, (s)->median, (s)->p90, (s)->p99, (s)->max, \
+                      (s)->mean, (s)->stddev, (s)->outliers, (s)->overhead
+
+static inline int
+stats_msb(uint64_t value)
+{
+    return 63 - __builtin_clzll(value);
+}
+
+static inline int
+stats_bucket(uint64_t value)
+{
+    if (value < STATS_SUB_BUCKETS) {
+        return value;
+    }
+    int msb = stats_msb(value);
+    int shift = msb - STATS_SUB_BITS;
+    return (shift + 1) * STATS_SUB_BUCKETS + ((value >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+/* smallest value that falls in a bucket */
+static inline uint64_t
+stats_bucket_low(int bucket)
+{
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / STATS_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % STATS_SUB_BUCKETS;
+    return (STATS_SUB_BUCKETS + sub) << shift;
+}
+
+static inline uint64_t
+stats_bucket_mid(int bucket)
+{
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / STATS_SUB_BUCKETS - 1;
+    return stats_bucket_low(bucket) + ((1ull << shift) >> 1);
+}
+
+static inline uint64_t
+stats_isqrt(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = 1ull << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+/* Measure the cost of reading the timer. The minimum is used, as that is the
+ * cost without interference. */
+static inline bench_ticks_t
+stats_timer_overhead(env_t env)
+{
+    bench_ticks_t overhead = UINT64_MAX;
+    for (int i = 0; i < STATS_CALIBRATE_ITERATIONS; i++) {
+        bench_ticks_t start = bench_now(env);
+        bench_ticks_t end = bench_now(env);
+        overhead = MIN(overhead, end - start);
+    }
+    return overhead;
+}
+
+static inline void
+stats_reset(stats_t *stats)
+{
+    bench_ticks_t overhead = stats->overhead;
+    memset(stats, 0, sizeof(*stats));
+    stats->min = UINT64_MAX;
+    stats->overhead = overhead;
+}
+
+/* Initialise a stats_t, calibrating the timer overhead to subtract from
+ * samples. */
+static inline void
+stats_init(env_t env, stats_t *stats)
+{
+    stats->overhead = stats_timer_overhead(env);
+    stats_reset(stats);
+}
+
+/* Initialise a stats_t for samples that are not timer readings (or that
+ * already have the overhead removed). */
+static inline void
+stats_init_raw(stats_t *stats)
+{
+    stats->overhead = 0;
+    stats_reset(stats);
+}
+
+static inline void
+stats_add(stats_t *stats, uint64_t value)
+{
+    value = value > stats->overhead ? value - stats->overhead : 0;
+
+    stats->count++;
+    stats->sum += value;
+    stats->min = MIN(stats->min, value);
+    stats->max = MAX(stats->max, value);
+    stats->buckets[stats_bucket(value)]++;
+}
+
+/* Value below which percent percent of the samples fall, to within the
+ * bucket resolution */
+static inline uint64_t
+stats_percentile(stats_t *stats, int percent)
+{
+    if (stats->count == 0) {
+        return 0;
+    }
+
+    uint32_t rank = DIV_ROUND_UP((uint64_t) stats->count * percent, 100);
+    uint32_t seen = 0;
+    for (int i = 0; i < STATS_NUM_BUCKETS; i++) {
+        seen += stats->buckets[i];
+        if (seen >= rank && seen > 0) {
+            /* the min and max are exact, the rest are bucket midpoints */
+            return MAX(stats->min, MIN(stats->max, stats_bucket_mid(i)));
+        }
+    }
+    return stats->max;
+}
+
+static inline void
+stats_summarise(stats_t *stats, stats_summary_t *summary)
+{
+    memset(summary, 0, sizeof(*summary));
+    summary->overhead = stats->overhead;
+    if (stats->count == 0) {
+        return;
+    }
+
+    summary->count = stats->count;
+    summary->min = stats->min;
+    summary->max = stats->max;
+    summary->mean = stats->sum / stats->count;
+    summary->median = stats_percentile(stats, 50);
+    summary->p90 = stats_percentile(stats, 90);
+    summary->p99 = stats_percentile(stats, 99);
+
+    uint64_t q1 = stats_percentile(stats, 25);
+    uint64_t q3 = stats_percentile(stats, 75);
+    uint64_t fence = q3 + 3 * (q3 - q1);
+
+    /* the variance is taken about the bucket midpoints, which is accurate to
+     * the resolution of the histogram. The sum of squares fits in 64 bits for
+     * the sample counts and values (well under 2^20 ticks from the mean) that
+     * our benchmarks produce. */
+    uint64_t sum_squares = 0;
+    for (int i = 0; i < STATS_NUM_BUCKETS; i++) {
+        if (stats->buckets[i] == 0) {
+            continue;
+        }
+        uint64_t mid = MAX(stats->min, MIN(stats->max, stats_bucket_mid(i)));
+        uint64_t diff = mid > summary->mean ? mid - summary->mean : summary->mean - mid;
+        sum_squares += diff * diff * stats->buckets[i];
+        if (stats_bucket_low(i) > fence) {
+            summary->outliers += stats->buckets[i];
+        }
+    }
+    summary->stddev = stats_isqrt(sum_squares / stats->count);
+}
+
+/* Run code warmup times, then time it iterations times into stats */
+#define STATS_MEASURE(env, stats, warmup, iterations, code) do { \
+        for (int _i = 0; _i < (warmup); _i++) { \
+            code; \
+        } \
+        for (int _i = 0; _i < (iterations); _i++) { \
+            bench_ticks_t _start = bench_now(env); \
+            code; \
+            bench_ticks_t _end = bench_now(env); \
+            stats_add(stats, _end - _start); \
+        } \
+    } while (0)
+
+#endif /* __STATS_H */
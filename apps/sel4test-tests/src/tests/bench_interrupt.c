@@ -0,0 +1,182 @@
+/*
+ * Copyright 2014, NICTA
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(NICTA_BSD)
+ */
+
+/* Find the highest timer interrupt rate a user level handler can keep up
+ * with, handling the interrupt the same way as INTERRUPT0001. */
+
+#include <sel4/sel4.h>
+#include <vka/object.h>
+
+#include "../helpers.h"
+#include "../bench.h"
+#include "../stats.h"
+
+#include <utils/util.h>
+
+#ifdef CONFIG_APP_TESTS_BENCHMARKS
+
+/* interrupts to take at each period */
+#define IRQS_PER_STEP 100
+/* interrupts to take when breaking down the cost of a single interrupt */
+#define BREAKDOWN_IRQS 100
+#define BREAKDOWN_TIMEOUT (100 * NS_IN_US)
+
+/* periods to try, longest first. We stop at the first one we can't sustain. */
+static const uint64_t periods_ns[] = {
+    10 * NS_IN_MS, 5 * NS_IN_MS, 2 * NS_IN_MS, 1 * NS_IN_MS,
+    500 * NS_IN_US, 200 * NS_IN_US, 100 * NS_IN_US,
+    50 * NS_IN_US, 20 * NS_IN_US, 10 * NS_IN_US,
+};
+
+static stats_t latency_stats;
+static stats_t wake_stats;
+static stats_t ack_stats;
+static stats_t reprogram_stats;
+
+/* Take IRQS_PER_STEP periodic interrupts. The period is sustained if no
+ * interrupt was missed (no gap between two wake ups of more than one and a
+ * half periods, and the total time is within an eighth of what we expect),
+ * and the handler latency (from waking up to having acked the interrupt)
+ * stays under half a period. */
+static bool
+bench_irq_period(env_t env, uint64_t period_ns)
+{
+    seL4_Word sender_badge;
+    bench_ticks_t max_gap = 0;
+
+    stats_reset(&latency_stats);
+    int error = timer_periodic(env->timer->timer, period_ns);
+    if (error) {
+        /* the timer can't go this fast */
+        return false;
+    }
+    timer_start(env->timer->timer);
+    sel4_timer_handle_single_irq(env->timer);
+
+    /* line up with the first interrupt before starting the clock */
+    wait_for_timer_interrupt(env);
+
+    bench_ticks_t start = bench_now(env);
+    bench_ticks_t last = start;
+    for (int i = 0; i < IRQS_PER_STEP; i++) {
+        seL4_Wait(env->timer_aep.cptr, &sender_badge);
+        bench_ticks_t woken = bench_now(env);
+        sel4_timer_handle_single_irq(env->timer);
+        bench_ticks_t acked = bench_now(env);
+
+        max_gap = MAX(max_gap, woken - last);
+        stats_add(&latency_stats, acked - woken);
+        last = woken;
+    }
+    bench_ticks_t elapsed = last - start;
+
+    timer_stop(env->timer->timer);
+    sel4_timer_handle_single_irq(env->timer);
+
+    uint64_t elapsed_ns = bench_ticks_to_ns(env, elapsed);
+    uint64_t expected_ns = IRQS_PER_STEP * period_ns;
+    uint64_t max_gap_ns = bench_ticks_to_ns(env, max_gap);
+    uint64_t max_latency_ns = bench_ticks_to_ns(env, latency_stats.max);
+
+    bool sustained = elapsed_ns <= expected_ns + expected_ns / 8 &&
+                     max_gap_ns <= period_ns + period_ns / 2 &&
+                     max_latency_ns <= period_ns / 2;
+
+    /* the latency stats are in ticks */
+    stats_summary_t latency;
+    stats_summarise(&latency_stats, &latency);
+    bench_report("IRQBENCH0001", "period_ns=%llu",
+                 "irqs=%d elapsed_ns=%llu expected_ns=%llu max_gap_ns=%llu max_latency_ns=%llu irqs_per_sec=%llu sustained=%d " STATS_FMT,
+                 period_ns, IRQS_PER_STEP, elapsed_ns, expected_ns, max_gap_ns, max_latency_ns,
+                 bench_rate(env, IRQS_PER_STEP, elapsed), sustained, STATS_ARGS(&latency));
+
+    return sustained;
+}
+
+/* Break down the cost of one interrupt into waking up, the ack and
+ * programming the next one. We block on the interrupt straight after
+ * programming it, and the wake up is timed from when it was due to fire, so
+ * it covers the kernel delivering the interrupt and switching to us, plus
+ * whatever error the timer has in firing on time. */
+static int
+bench_irq_breakdown(env_t env)
+{
+    seL4_Word sender_badge;
+    bench_ticks_t timeout = (BREAKDOWN_TIMEOUT * bench_ticks_per_second(env)) / NS_IN_S;
+
+    for (int i = 0; i < BREAKDOWN_IRQS; i++) {
+        bench_ticks_t start = bench_now(env);
+        int error = timer_oneshot_relative(env->timer->timer, BREAKDOWN_TIMEOUT);
+        bench_ticks_t programmed = bench_now(env);
+        test_assert(error == 0);
+        if (i == 0) {
+            timer_start(env->timer->timer);
+        }
+
+        seL4_Wait(env->timer_aep.cptr, &sender_badge);
+        bench_ticks_t woken = bench_now(env);
+        sel4_timer_handle_single_irq(env->timer);
+        bench_ticks_t acked = bench_now(env);
+
+        /* a timer that fires early counts as no delay */
+        bench_ticks_t due = programmed + timeout;
+        stats_add(&reprogram_stats, programmed - start);
+        stats_add(&wake_stats, woken > due ? woken - due : 0);
+        stats_add(&ack_stats, acked - woken);
+    }
+
+    timer_stop(env->timer->timer);
+    sel4_timer_handle_single_irq(env->timer);
+
+    /* these are in ticks */
+    stats_summary_t wake, ack, reprogram;
+    stats_summarise(&wake_stats, &wake);
+    stats_summarise(&ack_stats, &ack);
+    stats_summarise(&reprogram_stats, &reprogram);
+    bench_report("IRQBENCH0001", "step=%s", STATS_FMT, "wake", STATS_ARGS(&wake));
+    bench_report("IRQBENCH0001", "step=%s", STATS_FMT, "ack", STATS_ARGS(&ack));
+    bench_report("IRQBENCH0001", "step=%s", STATS_FMT, "reprogram", STATS_ARGS(&reprogram));
+    bench_report("IRQBENCH0001", "step=%s", "median_ns=%llu", "total",
+                 bench_ticks_to_ns(env, wake.median + ack.median + reprogram.median));
+
+    return SUCCESS;
+}
+
+static int
+test_bench_irq_rate(env_t env, void *args)
+{
+    uint64_t min_period_ns = 0;
+
+    stats_init(env, &latency_stats);
+    stats_init(env, &wake_stats);
+    stats_init(env, &ack_stats);
+    stats_init(env, &reprogram_stats);
+
+    for (int i = 0; i < ARRAY_SIZE(periods_ns); i++) {
+        if (!bench_irq_period(env, periods_ns[i])) {
+            break;
+        }
+        min_period_ns = periods_ns[i];
+    }
+
+    /* min_period_ns stays 0 if even the slowest rate we tried was not
+     * sustained (a slow or noisy host), which is a result, not a failure */
+    bench_report("IRQBENCH0001", "period_ns=min",
+                 "min_period_ns=%llu max_irqs_per_sec=%llu",
+                 min_period_ns, min_period_ns ? NS_IN_S / min_period_ns : 0);
+
+    int error = bench_irq_breakdown(env);
+    test_assert(error == SUCCESS);
+
+    return SUCCESS;
+}
+DEFINE_TEST(IRQBENCH0001, "Benchmark the highest sustainable timer interrupt rate", test_bench_irq_rate)
+
+#endif /* CONFIG_APP_TESTS_BENCHMARKS */
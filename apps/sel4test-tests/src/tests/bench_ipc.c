@@ -0,0 +1,170 @@
+/*
+ * Copyright 2014, NICTA
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(NICTA_BSD)
+ */
+
+/* IPC benchmarks. */
+
+#include <assert.h>
+#include <stdio.h>
+#include <sel4/sel4.h>
+#include <vka/object.h>
+#include <vka/capops.h>
+#include <utils/util.h>
+#include <pmu.h>
+
+#include "../helpers.h"
+#include "../bench.h"
+#include "../stats.h"
+
+#ifdef CONFIG_APP_TESTS_BENCHMARKS
+
+#define MAX_CLIENTS 64
+/* calls the server answers per client, per run */
+#define CALLS_PER_CLIENT 1000
+
+/* what the server tells a client in its reply */
+#define CLIENT_CONTINUE 0
+#define CLIENT_STOP     1
+
+/* Client priorities are either all the same, or staggered over
+ * NUM_PRIO_LEVELS levels below the default helper priority */
+#define NUM_PRIO_LEVELS 4
+
+/* Static, as this is too much for the stack of the test process */
+static helper_thread_t clients[MAX_CLIENTS];
+static uint32_t calls_per_client[MAX_CLIENTS];
+/* ticks between the server answering one call and receiving the next */
+static stats_t call_stats;
+
+static int
+bench_client_func(seL4_CPtr ep, seL4_Word badge)
+{
+    do {
+        seL4_SetMR(0, badge);
+        seL4_Call(ep, seL4_MessageInfo_new(0, 0, 0, 1));
+    } while (seL4_GetMR(0) == CLIENT_CONTINUE);
+
+    return SUCCESS;
+}
+
+/* Serve calls from num_clients clients until total_calls have been answered,
+ * then tell every client to stop. Returns the ticks taken to serve the calls,
+ * and the performance counters over them in counts. */
+static bench_ticks_t
+bench_serve(env_t env, seL4_CPtr ep, int num_clients, uint32_t total_calls, pmu_counts_t *counts)
+{
+    seL4_Word badge;
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 1);
+    pmu_counts_t pmu_start, pmu_end;
+
+    seL4_Wait(ep, &badge);
+    pmu_read(&pmu_start);
+    bench_ticks_t start = bench_now(env);
+    bench_ticks_t last = start;
+    for (uint32_t calls = 0; calls < total_calls; calls++) {
+        assert(badge > 0 && badge <= num_clients);
+        calls_per_client[badge - 1]++;
+        seL4_SetMR(0, CLIENT_CONTINUE);
+        seL4_ReplyWait(ep, tag, &badge);
+
+        /* the first round of calls from every client is warmup */
+        bench_ticks_t now = bench_now(env);
+        if (calls >= num_clients) {
+            stats_add(&call_stats, now - last);
+        }
+        last = now;
+    }
+    bench_ticks_t end = last;
+    pmu_read(&pmu_end);
+    pmu_diff(&pmu_start, &pmu_end, counts);
+
+    /* every client has exactly one call outstanding, or will make one */
+    for (int stopped = 1; stopped < num_clients; stopped++) {
+        seL4_SetMR(0, CLIENT_STOP);
+        seL4_ReplyWait(ep, tag, &badge);
+    }
+    seL4_SetMR(0, CLIENT_STOP);
+    seL4_Reply(tag);
+
+    return end - start;
+}
+
+static int
+bench_many_clients(env_t env, int num_clients, bool staggered)
+{
+    seL4_CPtr ep = vka_alloc_endpoint_leaky(&env->vka);
+    cspacepath_t path;
+    vka_cspace_make_path(&env->vka, ep, &path);
+
+    stats_reset(&call_stats);
+    for (int i = 0; i < num_clients; i++) {
+        calls_per_client[i] = 0;
+        create_helper_process(env, &clients[i]);
+        if (staggered) {
+            set_helper_priority(&clients[i], OUR_PRIO - 1 - (i % NUM_PRIO_LEVELS));
+        }
+    }
+
+    for (int i = 0; i < num_clients; i++) {
+        /* badges start at 1, so the server can tell them from an unbadged cap */
+        seL4_CPtr client_ep = sel4utils_mint_cap_to_process(&clients[i].process, path,
+                                                            seL4_AllRights, seL4_CapData_Badge_new(i + 1));
+        test_assert_fatal(client_ep != 0);
+        start_helper(env, &clients[i], (helper_fn_t) bench_client_func, client_ep, i + 1, 0, 0);
+    }
+
+    uint32_t total_calls = num_clients * CALLS_PER_CLIENT;
+    pmu_counts_t counts;
+    bench_ticks_t ticks = bench_serve(env, ep, num_clients, total_calls, &counts);
+
+    for (int i = 0; i < num_clients; i++) {
+        test_check(wait_for_helper(&clients[i]) == SUCCESS);
+        cleanup_helper(env, &clients[i]);
+    }
+
+    /* Fairness: the min and max share of calls a client got, and Jain's
+     * fairness index (1000 when every client gets the same share) */
+    uint32_t min = UINT32_MAX, max = 0;
+    uint64_t sum_squares = 0;
+    for (int i = 0; i < num_clients; i++) {
+        min = MIN(min, calls_per_client[i]);
+        max = MAX(max, calls_per_client[i]);
+        sum_squares += (uint64_t) calls_per_client[i] * calls_per_client[i];
+    }
+    uint64_t jain = ((uint64_t) total_calls * total_calls * 1000) / (num_clients * sum_squares);
+
+    stats_summary_t summary;
+    stats_summarise(&call_stats, &summary);
+    bench_report("IPCBENCH0001", "clients=%d prio=%s",
+                 "calls=%u ticks=%llu calls_per_sec=%llu min_calls=%u max_calls=%u jain_permille=%llu " STATS_FMT " " PMU_FMT,
+                 num_clients, staggered ? "staggered" : "flat",
+                 total_calls, ticks, bench_rate(env, total_calls, ticks), min, max, jain,
+                 STATS_ARGS(&summary), PMU_ARGS(&counts));
+
+    int error = cnode_delete(env, ep);
+    test_assert(!error);
+    return SUCCESS;
+}
+
+static int
+test_bench_many_clients(env_t env, void *args)
+{
+    stats_init(env, &call_stats);
+    pmu_init();
+    for (int staggered = 0; staggered <= 1; staggered++) {
+        for (int num_clients = 1; num_clients <= MAX_CLIENTS; num_clients *= 2) {
+            int result = bench_many_clients(env, num_clients, staggered);
+            test_assert(result == SUCCESS);
+        }
+    }
+    return SUCCESS;
+}
+DEFINE_TEST(IPCBENCH0001, "Benchmark one server seL4_ReplyWait with many badged clients", test_bench_many_clients)
+
+#endif /* CONFIG_APP_TESTS_BENCHMARKS */
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2014, NICTA
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(NICTA_BSD)
+ */
+
+/* Benchmarks for mapping ranges into EPT and IOMMU page tables. Like the
+ * tests in ept.c and iopt.c these never touch the mappings, they only time
+ * the kernel operations. */
+
+#include <assert.h>
+
+#include <sel4/sel4.h>
+#include <vka/object.h>
+#include <vka/capops.h>
+
+#include "../helpers.h"
+#include "../bench.h"
+#include "../stats.h"
+
+#if defined(CONFIG_APP_TESTS_BENCHMARKS) && (defined(CONFIG_VTX) || defined(CONFIG_IOMMU))
+
+/* Same bases as ept.c and iopt.c */
+#define EPT_MAP_BASE  0x8000000
+#define IOPT_MAP_BASE 0x10000000
+
+/* number of pages per benchmark point. Frames are allocated before the clock
+ * starts, so this is bounded by the memory we are willing to hand out. */
+#define NUM_4K_PAGES 1024
+#define NUM_4M_PAGES 8
+
+#define EPT_PT_SPAN  BIT(21)
+
+/* ticks per page mapped, and per table created */
+static stats_t page_stats;
+static stats_t table_stats;
+
+static void
+report_mapping(env_t env, const char *name, int size_bits, int num, int num_tables)
+{
+    stats_summary_t pages, tables;
+
+    stats_summarise(&page_stats, &pages);
+    stats_summarise(&table_stats, &tables);
+
+    bench_report(name, "page_bits=%d pages=%d kind=page", "pages_per_sec=%llu " STATS_FMT,
+                 size_bits, num, bench_rate(env, num, page_stats.sum), STATS_ARGS(&pages));
+    bench_report(name, "page_bits=%d pages=%d kind=table",
+                 "tables=%d pages_per_sec_with_tables=%llu " STATS_FMT,
+                 size_bits, num, num_tables, bench_rate(env, num, page_stats.sum + table_stats.sum),
+                 STATS_ARGS(&tables));
+}
+
+#ifdef CONFIG_VTX
+
+static void
+alloc_frames(env_t env, seL4_CPtr *frames, int num, int size_bits)
+{
+    for (int i = 0; i < num; i++) {
+        frames[i] = vka_alloc_frame_leaky(&env->vka, size_bits);
+        test_assert_fatal(frames[i]);
+    }
+}
+
+/* Map num frames of size_bits at consecutive guest physical addresses into a
+ * fresh EPT. Tables are created as they are needed, and timed separately. */
+static int
+bench_ept_map(env_t env, seL4_CPtr *frames, int num, int size_bits)
+{
+    int error;
+    int num_tables = 1;
+    bench_ticks_t start;
+
+    stats_reset(&page_stats);
+    stats_reset(&table_stats);
+
+    seL4_CPtr pdpt = vka_alloc_ept_page_directory_pointer_table_leaky(&env->vka);
+    test_assert_fatal(pdpt);
+
+    /* one PD covers everything we map */
+    start = bench_now(env);
+    seL4_CPtr pd = vka_alloc_ept_page_directory_leaky(&env->vka);
+    error = seL4_IA32_EPTPageDirectory_Map(pd, pdpt, EPT_MAP_BASE, seL4_IA32_Default_VMAttributes);
+    stats_add(&table_stats, bench_now(env) - start);
+    test_assert(error == seL4_NoError);
+
+    for (int i = 0; i < num; i++) {
+        seL4_Word gpaddr = EPT_MAP_BASE + i * BIT(size_bits);
+
+        if (size_bits == seL4_PageBits && (gpaddr % EPT_PT_SPAN) == 0) {
+            start = bench_now(env);
+            seL4_CPtr pt = vka_alloc_ept_page_table_leaky(&env->vka);
+            error = seL4_IA32_EPTPageTable_Map(pt, pdpt, gpaddr, seL4_IA32_Default_VMAttributes);
+            stats_add(&table_stats, bench_now(env) - start);
+            num_tables++;
+            test_assert(error == seL4_NoError);
+        }
+
+        start = bench_now(env);
+        error = seL4_IA32_Page_Map(frames[i], pdpt, gpaddr, seL4_AllRights, seL4_IA32_Default_VMAttributes);
+        stats_add(&page_stats, bench_now(env) - start);
+        test_assert(error == seL4_NoError);
+    }
+
+    report_mapping(env, "EPTBENCH0001", size_bits, num, num_tables);
+
+    return SUCCESS;
+}
+
+static int
+test_bench_ept_map(env_t env, void *args)
+{
+    static seL4_CPtr frames[NUM_4K_PAGES];
+    int error;
+
+    stats_init(env, &page_stats);
+    stats_init(env, &table_stats);
+
+    alloc_frames(env, frames, NUM_4K_PAGES, seL4_PageBits);
+    error = bench_ept_map(env, frames, NUM_4K_PAGES, seL4_PageBits);
+    test_assert(error == SUCCESS);
+
+    alloc_frames(env, frames, NUM_4M_PAGES, seL4_LargePageBits);
+    error = bench_ept_map(env, frames, NUM_4M_PAGES, seL4_LargePageBits);
+    test_assert(error == SUCCESS);
+
+    return SUCCESS;
+}
+DEFINE_TEST(EPTBENCH0001, "Benchmark mapping 4K and 4M pages into an EPT", test_bench_ept_map)
+
+#endif /* CONFIG_VTX */
+
+#ifdef CONFIG_IOMMU
+
+#define FAKE_PCI_DEVICE 0x216u
+#define DOMAIN_ID       0xf
+
+/* Map num 4K frames at consecutive IO virtual addresses. The number of IO page
+ * table levels is up to the IOMMU, so tables are created whenever a mapping
+ * fails its lookup, as in iopt.c. */
+static int
+bench_iopt_map(env_t env, seL4_CPtr iospace, seL4_Word iobase, seL4_CPtr *frames, int num)
+{
+    int error;
+    int num_tables = 0;
+    bench_ticks_t start;
+
+    stats_reset(&page_stats);
+    stats_reset(&table_stats);
+
+    for (int i = 0; i < num; i++) {
+        seL4_Word ioaddr = iobase + i * BIT(seL4_PageBits);
+
+        start = bench_now(env);
+        error = seL4_IA32_Page_MapIO(frames[i], iospace, seL4_AllRights, ioaddr);
+        while (error == seL4_FailedLookup) {
+            /* the failed lookup is part of the cost of building the tables */
+            seL4_CPtr pt = vka_alloc_io_page_table_leaky(&env->vka);
+            test_assert_fatal(pt);
+            error = seL4_IA32_IOPageTable_Map(pt, iospace, ioaddr);
+            test_assert(error == seL4_NoError);
+            num_tables++;
+            stats_add(&table_stats, bench_now(env) - start);
+
+            start = bench_now(env);
+            error = seL4_IA32_Page_MapIO(frames[i], iospace, seL4_AllRights, ioaddr);
+        }
+        stats_add(&page_stats, bench_now(env) - start);
+        test_assert(error == seL4_NoError);
+    }
+
+    report_mapping(env, "IOPTBENCH0001", seL4_PageBits, num, num_tables);
+
+    return SUCCESS;
+}
+
+static int
+test_bench_iopt_map(env_t env, void *args)
+{
+    /* one for the single page, then the 4M range */
+    static seL4_CPtr frames[NUM_4K_PAGES + 1];
+    int error;
+    seL4_CPtr iospace;
+    cspacepath_t master_path, iospace_path;
+
+    stats_init(env, &page_stats);
+    stats_init(env, &table_stats);
+
+    error = vka_cspace_alloc(&env->vka, &iospace);
+    test_assert(!error);
+    vka_cspace_make_path(&env->vka, iospace, &iospace_path);
+    vka_cspace_make_path(&env->vka, env->io_space, &master_path);
+    error = vka_cnode_mint(&iospace_path, &master_path, seL4_AllRights, (seL4_CapData_t) {
+        .words = { (DOMAIN_ID << 16) | FAKE_PCI_DEVICE }
+    });
+    test_assert(error == seL4_NoError);
+
+    for (int i = 0; i < NUM_4K_PAGES + 1; i++) {
+        frames[i] = vka_alloc_frame_leaky(&env->vka, seL4_PageBits);
+        test_assert_fatal(frames[i]);
+    }
+
+    /* A single page pays for all the tables above it, a 4M range of pages
+     * shares them. The IOMMU only maps 4K frames, so the 4M range is built
+     * from those. */
+    error = bench_iopt_map(env, iospace, IOPT_MAP_BASE, frames, 1);
+    test_assert(error == SUCCESS);
+    error = bench_iopt_map(env, iospace, IOPT_MAP_BASE + BIT(seL4_LargePageBits), frames + 1,
+                           BIT(seL4_LargePageBits - seL4_PageBits));
+    test_assert(error == SUCCESS);
+
+    cnode_delete(env, iospace);
+    return SUCCESS;
+}
+DEFINE_TEST(IOPTBENCH0001, "Benchmark mapping a page and a 4M range into an IOMMU page table", test_bench_iopt_map)
+
+#endif /* CONFIG_IOMMU */
+
+#endif /* CONFIG_APP_TESTS_BENCHMARKS && (CONFIG_VTX || CONFIG_IOMMU) */
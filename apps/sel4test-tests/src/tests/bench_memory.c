@@ -0,0 +1,115 @@
+/*
+ * Copyright 2014, NICTA
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(NICTA_BSD)
+ */
+
+/* Memory bandwidth and latency on cached and uncached mappings. As in
+ * cache.c, the same frames are mapped twice, once with each cacheability, so
+ * both mappings measure the same physical memory. On ARM an uncached mapping
+ * is device memory. */
+
+#include <assert.h>
+#include <stdio.h>
+#include <sel4/sel4.h>
+#include <vka/object.h>
+#include <sel4utils/util.h>
+#include <membench.h>
+
+#include "../helpers.h"
+#include "../bench.h"
+
+#ifdef CONFIG_APP_TESTS_BENCHMARKS
+
+/* buffer sizes from 4K to MEMBENCH_MAX_BYTES, multiplying by 4 each step */
+#define MEMBENCH_MIN_BYTES BIT(seL4_PageBits)
+#define MEMBENCH_MAX_BYTES (4 * 1024 * 1024)
+#define MEMBENCH_MAX_PAGES (MEMBENCH_MAX_BYTES / BIT(seL4_PageBits))
+
+/* timed passes per point, the fastest is reported */
+#define MEMBENCH_PASSES 3
+
+static uint64_t
+membench_clock(void *cookie)
+{
+    return bench_now((env_t) cookie);
+}
+
+/* Map the frames at a fresh reservation, cached or not */
+static void *
+map_frames(env_t env, seL4_CPtr *frames, int cacheable)
+{
+    void *vaddr;
+    reservation_t reservation = vspace_reserve_range(&env->vspace, MEMBENCH_MAX_BYTES, seL4_AllRights,
+                                                     cacheable, &vaddr);
+    test_assert_fatal(reservation.res);
+
+    int error = vspace_map_pages_at_vaddr(&env->vspace, frames, NULL, vaddr, MEMBENCH_MAX_PAGES,
+                                          seL4_PageBits, reservation);
+    test_assert_fatal(!error);
+    return vaddr;
+}
+
+static void
+bench_mapping(env_t env, const char *mapping, void *buf)
+{
+    for (size_t bytes = MEMBENCH_MIN_BYTES; bytes <= MEMBENCH_MAX_BYTES; bytes *= 4) {
+        for (int op = 0; op < MEMBENCH_NUM_OPS; op++) {
+            uint64_t ticks = membench_run(op, buf, bytes, MEMBENCH_PASSES, membench_clock, env);
+            uint64_t ns = bench_ticks_to_ns(env, ticks);
+            size_t units = membench_units(op, bytes);
+
+            if (op == MEMBENCH_CHASE) {
+                bench_report("MEMBENCH0001", "mapping=%s op=%s bytes=%u", "ticks=%llu loads=%u ps_per_load=%llu",
+                             mapping, membench_op_names[op], bytes, ticks, units, ns * 1000 / units);
+            } else {
+                /* bytes per microsecond is MB/s */
+                bench_report("MEMBENCH0001", "mapping=%s op=%s bytes=%u", "ticks=%llu mb_per_s=%llu",
+                             mapping, membench_op_names[op], bytes, ticks,
+                             ns ? (uint64_t) units * NS_IN_US / ns : 0);
+            }
+        }
+    }
+}
+
+static int
+test_bench_memory(env_t env, void *args)
+{
+    static seL4_CPtr frames[MEMBENCH_MAX_PAGES];
+    static seL4_CPtr uncached_frames[MEMBENCH_MAX_PAGES];
+
+    for (int i = 0; i < MEMBENCH_MAX_PAGES; i++) {
+        frames[i] = vka_alloc_frame_leaky(&env->vka, seL4_PageBits);
+        test_assert_fatal(frames[i] != seL4_CapNull);
+        uncached_frames[i] = get_free_slot(env);
+        test_assert_fatal(uncached_frames[i] != seL4_CapNull);
+        int error = cnode_copy(env, frames[i], uncached_frames[i], seL4_AllRights);
+        test_assert_fatal(!error);
+    }
+
+    void *cached = map_frames(env, frames, 1);
+    void *uncached = map_frames(env, uncached_frames, 0);
+
+    bench_mapping(env, "cached", cached);
+
+#ifdef CONFIG_ARCH_ARM
+    /* write back and drop what the cached runs left in the cache, so it
+     * can't be evicted over the uncached runs' pointer chains */
+    for (int i = 0; i < MEMBENCH_MAX_PAGES; i++) {
+        int error = seL4_ARM_Page_CleanInvalidate_Data(frames[i], 0, BIT(seL4_PageBits));
+        test_assert(!error);
+    }
+#endif
+
+    bench_mapping(env, "uncached", uncached);
+
+    return SUCCESS;
+}
+DEFINE_TEST(MEMBENCH0001, "Benchmark memory bandwidth and latency on cached and uncached mappings",
+            test_bench_memory)
+
+#endif /* CONFIG_APP_TESTS_BENCHMARKS */
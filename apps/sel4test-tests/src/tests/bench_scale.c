@@ -0,0 +1,291 @@
+/*
+ * Copyright 2014, NICTA
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(NICTA_BSD)
+ */
+
+/* Scalability benchmarks. Each builds up a growing number of kernel objects
+ * and times common operations at every step, so that operations whose cost
+ * grows with the number of objects in the system show up as a slope in the
+ * results. Every record carries the object count as a parameter. */
+
+#include <assert.h>
+#include <stdio.h>
+#include <sel4/sel4.h>
+#include <vka/object.h>
+#include <vka/capops.h>
+#include <sel4utils/mapping.h>
+
+#include "../helpers.h"
+#include "../bench.h"
+#include "../stats.h"
+
+#ifdef CONFIG_APP_TESTS_BENCHMARKS
+
+/* object counts go from 2^SCALE_MIN_BITS to 2^SCALE_MAX_BITS, multiplying by
+ * 2^SCALE_STEP_BITS at each step */
+#define SCALE_MIN_BITS  4
+#define SCALE_MAX_BITS  12
+#define SCALE_STEP_BITS 2
+
+/* mapping frames is bounded by the memory we hand out, as in bench_mapping.c */
+#define SCALE_MAX_FRAMES 1024
+
+#define IPC_WARMUP     16
+#define IPC_ITERATIONS 1000
+
+/* what the echo thread is sent to make it exit */
+#define ECHO_STOP 1
+
+static stats_t op_stats;
+
+static int
+echo_func(seL4_CPtr ep)
+{
+    seL4_Word badge;
+    seL4_MessageInfo_t tag = seL4_Wait(ep, &badge);
+
+    while (seL4_MessageInfo_get_label(tag) != ECHO_STOP) {
+        tag = seL4_ReplyWait(ep, tag, &badge);
+    }
+
+    return SUCCESS;
+}
+
+/* Time IPC round trips to a helper thread, with however many objects the
+ * caller has created in existence. Retyped TCBs are never started, so this
+ * shows costs that grow with the number of objects, not with the number of
+ * runnable threads. */
+static void
+bench_ipc_round_trip(env_t env, const char *name, const char *type, int num)
+{
+    helper_thread_t echo;
+    stats_summary_t summary;
+    seL4_CPtr ep = vka_alloc_endpoint_leaky(&env->vka);
+    seL4_MessageInfo_t tag = seL4_MessageInfo_new(0, 0, 0, 0);
+
+    create_helper_thread(env, &echo);
+    start_helper(env, &echo, (helper_fn_t) echo_func, ep, 0, 0, 0);
+
+    stats_reset(&op_stats);
+    STATS_MEASURE(env, &op_stats, IPC_WARMUP, IPC_ITERATIONS, seL4_Call(ep, tag));
+    stats_summarise(&op_stats, &summary);
+    bench_report(name, "objects=%d type=%s op=ipc", STATS_FMT, num, type, STATS_ARGS(&summary));
+
+    seL4_Send(ep, seL4_MessageInfo_new(ECHO_STOP, 0, 0, 0));
+    test_check(wait_for_helper(&echo) == SUCCESS);
+    cleanup_helper(env, &echo);
+    cnode_delete(env, ep);
+}
+
+/* Retype num objects of type one at a time into a fresh CNode, time IPC with
+ * them in existence, then revoke the untyped to destroy them all at once.
+ * Returns FAILURE if the memory for num objects could not be found. */
+static int
+bench_retype_revoke(env_t env, seL4_Word type, const char *type_name, int num_bits)
+{
+    vka_object_t untyped, cnode;
+    stats_summary_t summary;
+    int num = BIT(num_bits);
+    int error;
+
+    error = vka_alloc_untyped(&env->vka, vka_get_object_size(type, 0) + num_bits, &untyped);
+    if (error) {
+        return FAILURE;
+    }
+    error = vka_alloc_cnode_object(&env->vka, num_bits, &cnode);
+    if (error) {
+        vka_free_object(&env->vka, &untyped);
+        return FAILURE;
+    }
+
+    stats_reset(&op_stats);
+    for (int i = 0; i < num; i++) {
+        bench_ticks_t start = bench_now(env);
+        error = seL4_Untyped_Retype(untyped.cptr, type, 0, env->cspace_root, cnode.cptr,
+                                    seL4_WordBits, i, 1);
+        stats_add(&op_stats, bench_now(env) - start);
+        test_assert_fatal(!error);
+    }
+    stats_summarise(&op_stats, &summary);
+    bench_report("SCALEBENCH0001", "objects=%d type=%s op=retype", STATS_FMT,
+                 num, type_name, STATS_ARGS(&summary));
+
+    bench_ipc_round_trip(env, "SCALEBENCH0001", type_name, num);
+
+    /* revoking the untyped deletes every object retyped from it */
+    bench_ticks_t start = bench_now(env);
+    error = cnode_revoke(env, untyped.cptr);
+    bench_ticks_t ticks = bench_now(env) - start - op_stats.overhead;
+    test_assert_fatal(!error);
+    bench_report("SCALEBENCH0001", "objects=%d type=%s op=revoke", "ticks=%llu ticks_per_object=%llu",
+                 num, type_name, ticks, ticks / num);
+
+    vka_free_object(&env->vka, &cnode);
+    vka_free_object(&env->vka, &untyped);
+    return SUCCESS;
+}
+
+static int
+test_bench_scale_objects(env_t env, void *args)
+{
+    stats_init(env, &op_stats);
+
+    for (int bits = SCALE_MIN_BITS; bits <= SCALE_MAX_BITS; bits += SCALE_STEP_BITS) {
+        /* stop growing a type once memory runs out, the smallest step must fit */
+        if (bench_retype_revoke(env, seL4_TCBObject, "tcb", bits) != SUCCESS) {
+            test_check(bits > SCALE_MIN_BITS);
+            break;
+        }
+    }
+    for (int bits = SCALE_MIN_BITS; bits <= SCALE_MAX_BITS; bits += SCALE_STEP_BITS) {
+        if (bench_retype_revoke(env, seL4_EndpointObject, "endpoint", bits) != SUCCESS) {
+            test_check(bits > SCALE_MIN_BITS);
+            break;
+        }
+    }
+    return SUCCESS;
+}
+DEFINE_TEST(SCALEBENCH0001, "Benchmark retype, IPC and revoke with thousands of TCBs and endpoints",
+            test_bench_scale_objects)
+
+/* Derive num caps from an endpoint cap, either all copied from the original
+ * (wide), or each copied from the one before it (deep), then revoke the
+ * original to delete them all. */
+static int
+bench_derivation(env_t env, int num_bits, bool deep)
+{
+    vka_object_t cnode;
+    stats_summary_t summary;
+    int num = BIT(num_bits);
+    int error;
+    const char *shape = deep ? "deep" : "wide";
+
+    seL4_CPtr ep = vka_alloc_endpoint_leaky(&env->vka);
+    error = vka_alloc_cnode_object(&env->vka, num_bits, &cnode);
+    test_assert_fatal(!error);
+
+    stats_reset(&op_stats);
+    for (int i = 0; i < num; i++) {
+        bench_ticks_t start = bench_now(env);
+        if (deep && i > 0) {
+            error = seL4_CNode_Copy(cnode.cptr, i, num_bits, cnode.cptr, i - 1, num_bits, seL4_AllRights);
+        } else {
+            error = seL4_CNode_Copy(cnode.cptr, i, num_bits, env->cspace_root, ep, seL4_WordBits,
+                                    seL4_AllRights);
+        }
+        stats_add(&op_stats, bench_now(env) - start);
+        test_assert_fatal(!error);
+    }
+    stats_summarise(&op_stats, &summary);
+    bench_report("SCALEBENCH0002", "caps=%d shape=%s op=copy", STATS_FMT, num, shape, STATS_ARGS(&summary));
+
+    bench_ticks_t start = bench_now(env);
+    error = cnode_revoke(env, ep);
+    bench_ticks_t ticks = bench_now(env) - start - op_stats.overhead;
+    test_assert_fatal(!error);
+    bench_report("SCALEBENCH0002", "caps=%d shape=%s op=revoke", "ticks=%llu ticks_per_cap=%llu",
+                 num, shape, ticks, ticks / num);
+
+    vka_free_object(&env->vka, &cnode);
+    cnode_delete(env, ep);
+    return SUCCESS;
+}
+
+static int
+test_bench_scale_derivation(env_t env, void *args)
+{
+    stats_init(env, &op_stats);
+
+    for (int deep = 0; deep <= 1; deep++) {
+        for (int bits = SCALE_MIN_BITS; bits <= SCALE_MAX_BITS; bits += SCALE_STEP_BITS) {
+            int error = bench_derivation(env, bits, deep);
+            test_assert(error == SUCCESS);
+        }
+    }
+    return SUCCESS;
+}
+DEFINE_TEST(SCALEBENCH0002, "Benchmark copy and revoke with thousands of derived caps",
+            test_bench_scale_derivation)
+
+/* Map num frames at consecutive addresses from vstart, then unmap them,
+ * timing each. Page tables are created as needed and left in place for the
+ * next step, so only the frame operations are timed. */
+static int
+bench_map_frames(env_t env, seL4_CPtr *frames, int num, seL4_Word vstart)
+{
+    stats_summary_t summary;
+    int error;
+
+    stats_reset(&op_stats);
+    for (int i = 0; i < num; i++) {
+        seL4_Word vaddr = vstart + i * BIT(seL4_PageBits);
+
+        bench_ticks_t start = bench_now(env);
+        error = seL4_ARCH_Page_Map(frames[i], env->page_directory, vaddr, seL4_AllRights,
+                                   seL4_ARCH_Default_VMAttributes);
+        bench_ticks_t end = bench_now(env);
+        if (error == seL4_FailedLookup) {
+            seL4_CPtr pt = vka_alloc_page_table_leaky(&env->vka);
+            test_assert_fatal(pt);
+            error = seL4_ARCH_PageTable_Map(pt, env->page_directory, vaddr,
+                                            seL4_ARCH_Default_VMAttributes);
+            test_assert_fatal(!error);
+
+            start = bench_now(env);
+            error = seL4_ARCH_Page_Map(frames[i], env->page_directory, vaddr, seL4_AllRights,
+                                       seL4_ARCH_Default_VMAttributes);
+            end = bench_now(env);
+        }
+        stats_add(&op_stats, end - start);
+        test_assert_fatal(!error);
+    }
+    stats_summarise(&op_stats, &summary);
+    bench_report("SCALEBENCH0003", "frames=%d op=map", STATS_FMT, num, STATS_ARGS(&summary));
+
+    stats_reset(&op_stats);
+    for (int i = 0; i < num; i++) {
+        bench_ticks_t start = bench_now(env);
+        error = seL4_ARCH_Page_Unmap(frames[i]);
+        stats_add(&op_stats, bench_now(env) - start);
+        test_assert_fatal(!error);
+    }
+    stats_summarise(&op_stats, &summary);
+    bench_report("SCALEBENCH0003", "frames=%d op=unmap", STATS_FMT, num, STATS_ARGS(&summary));
+
+    return SUCCESS;
+}
+
+static int
+test_bench_scale_frames(env_t env, void *args)
+{
+    static seL4_CPtr frames[SCALE_MAX_FRAMES];
+    seL4_Word vstart;
+
+    stats_init(env, &op_stats);
+
+    reservation_t reserve = vspace_reserve_range(&env->vspace, SCALE_MAX_FRAMES * BIT(seL4_PageBits),
+                                                  seL4_AllRights, 1, (void **) &vstart);
+    test_assert_fatal(vstart != 0);
+
+    for (int i = 0; i < SCALE_MAX_FRAMES; i++) {
+        frames[i] = vka_alloc_frame_leaky(&env->vka, seL4_PageBits);
+        test_assert_fatal(frames[i]);
+    }
+
+    for (int num = BIT(SCALE_MIN_BITS); num <= SCALE_MAX_FRAMES; num *= BIT(SCALE_STEP_BITS)) {
+        int error = bench_map_frames(env, frames, num, vstart);
+        test_assert(error == SUCCESS);
+    }
+
+    vspace_free_reservation(&env->vspace, reserve);
+    return SUCCESS;
+}
+DEFINE_TEST(SCALEBENCH0003, "Benchmark map and unmap with up to a thousand mapped frames",
+            test_bench_scale_frames)
+
+#endif /* CONFIG_APP_TESTS_BENCHMARKS */
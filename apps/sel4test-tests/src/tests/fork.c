@@ -0,0 +1,120 @@
+/*
+ * Copyright 2014, NICTA
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(NICTA_BSD)
+ */
+
+/* Tests for copy on write helper forks */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sel4/sel4.h>
+
+#include "../helpers.h"
+
+#define PARENT_VALUE 0xfeed
+#define CHILD_VALUE  0xbeef
+
+#define BUFFER_SIZE (3 * BIT(seL4_PageBits))
+
+static volatile seL4_Word fork_global;
+
+static int
+fork_global_func(void)
+{
+    if (fork_global != PARENT_VALUE) {
+        return FAILURE;
+    }
+    fork_global = CHILD_VALUE;
+    return fork_global == CHILD_VALUE ? SUCCESS : FAILURE;
+}
+
+static int
+test_fork_global(env_t env, void *args)
+{
+    helper_fork_t *fork = malloc(sizeof(helper_fork_t));
+    test_assert_fatal(fork != NULL);
+
+    fork_global = PARENT_VALUE;
+    create_helper_fork(env, fork);
+    start_helper(env, &fork->helper, (helper_fn_t) fork_global_func, 0, 0, 0, 0);
+    test_check(wait_for_helper(&fork->helper) == SUCCESS);
+
+    /* the child wrote to its own copy */
+    test_check(fork_global == PARENT_VALUE);
+    test_check(fork->num_copied > 0);
+
+    cleanup_helper_fork(env, fork);
+    free(fork);
+    return SUCCESS;
+}
+DEFINE_TEST(FORK0001, "Test a fork inherits globals and copies them on write", test_fork_global)
+
+static int
+fork_heap_func(uint8_t *buffer)
+{
+    for (int i = 0; i < BUFFER_SIZE; i++) {
+        if (buffer[i] != (uint8_t) i) {
+            return FAILURE;
+        }
+    }
+    memset(buffer, 0, BUFFER_SIZE);
+    return SUCCESS;
+}
+
+static int
+test_fork_heap(env_t env, void *args)
+{
+    helper_fork_t *fork = malloc(sizeof(helper_fork_t));
+    uint8_t *buffer = malloc(BUFFER_SIZE);
+    test_assert_fatal(fork != NULL && buffer != NULL);
+
+    for (int i = 0; i < BUFFER_SIZE; i++) {
+        buffer[i] = (uint8_t) i;
+    }
+
+    create_helper_fork(env, fork);
+    start_helper(env, &fork->helper, (helper_fn_t) fork_heap_func, (seL4_Word) buffer, 0, 0, 0);
+    test_check(wait_for_helper(&fork->helper) == SUCCESS);
+
+    for (int i = 0; i < BUFFER_SIZE; i++) {
+        test_check(buffer[i] == (uint8_t) i);
+    }
+
+    cleanup_helper_fork(env, fork);
+    free(buffer);
+    free(fork);
+    return SUCCESS;
+}
+DEFINE_TEST(FORK0002, "Test a fork inherits the heap and copies it on write", test_fork_heap)
+
+static int
+fork_snapshot_func(void)
+{
+    return fork_global == PARENT_VALUE ? SUCCESS : FAILURE;
+}
+
+static int
+test_fork_snapshot(env_t env, void *args)
+{
+    helper_fork_t *fork = malloc(sizeof(helper_fork_t));
+    test_assert_fatal(fork != NULL);
+
+    fork_global = PARENT_VALUE;
+    create_helper_fork(env, fork);
+
+    /* written before the child runs, but after it forked */
+    fork_global = CHILD_VALUE;
+    start_helper(env, &fork->helper, (helper_fn_t) fork_snapshot_func, 0, 0, 0, 0);
+    test_check(wait_for_helper(&fork->helper) == SUCCESS);
+    test_check(fork_global == CHILD_VALUE);
+
+    cleanup_helper_fork(env, fork);
+    free(fork);
+    return SUCCESS;
+}
+DEFINE_TEST(FORK0003, "Test a fork does not see writes its parent makes after forking", test_fork_snapshot)
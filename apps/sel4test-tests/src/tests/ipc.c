@@ -328,7 +328,8 @@ test_call_replywait(env_t env, void *args)
 {
     return test_ipc_pair(env, call_func, replywait_func, false);
 }
-DEFINE_TEST(IPC0002, "Test seL4_Call + seL4_ReplyWait", test_call_replywait)
+/* seL4_Call and seL4_ReplyWait are the fastpath, so keep an eye on them */
+DEFINE_TEST_BUDGET(IPC0002, "Test seL4_Call + seL4_ReplyWait", test_call_replywait, 2 * US_IN_S)
 
 static int
 test_call_reply_and_wait(env_t env, void *args)
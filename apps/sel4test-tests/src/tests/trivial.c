@@ -38,3 +38,44 @@ int test_allocator(env_t env, void *arg)
 }
 DEFINE_TEST(TRIVIAL0001, "Ensure the allocator works", test_allocator)
 DEFINE_TEST(TRIVIAL0002, "Ensure the allocator works more than once", test_allocator)
+
+/* the top bit set, so this would not survive a trip through atoi */
+#define FULL_WIDTH_ARG(i) (((seL4_Word) 1 << (seL4_WordBits - 1)) | (i))
+
+static int
+check_helper_args(seL4_Word arg0, seL4_Word arg1, seL4_Word arg2, seL4_Word arg3,
+                  seL4_Word arg4, seL4_Word arg5, seL4_Word arg6, seL4_Word arg7)
+{
+    seL4_Word args[] = {arg0, arg1, arg2, arg3, arg4, arg5, arg6, arg7};
+
+    for (int i = 0; i < HELPER_THREAD_MAX_ARGS; i++) {
+        if (args[i] != FULL_WIDTH_ARG(i)) {
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+int test_helper_args(env_t env, void *arg)
+{
+    helper_thread_t thread;
+    seL4_Word args[HELPER_THREAD_MAX_ARGS];
+
+    for (int i = 0; i < HELPER_THREAD_MAX_ARGS; i++) {
+        args[i] = FULL_WIDTH_ARG(i);
+    }
+
+    for (int is_process = 0; is_process <= 1; is_process++) {
+        if (is_process) {
+            create_helper_process(env, &thread);
+        } else {
+            create_helper_thread(env, &thread);
+        }
+        start_helper_v(env, &thread, (helper_fn_t) check_helper_args, HELPER_THREAD_MAX_ARGS, args);
+        test_check(wait_for_helper(&thread) == SUCCESS);
+        cleanup_helper(env, &thread);
+    }
+
+    return SUCCESS;
+}
+DEFINE_TEST(TRIVIAL0003, "Ensure full width helper args are passed intact", test_helper_args)
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2015, Josef Mihalits
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *
+ */
+
+/*
+ * Memory bandwidth and latency kernels.
+ *
+ * Each operation makes one pass over a buffer:
+ *
+ *   MEMBENCH_READ   read every word
+ *   MEMBENCH_WRITE  write every word
+ *   MEMBENCH_COPY   copy the first half of the buffer to the second half
+ *   MEMBENCH_CHASE  follow a pointer chain visiting every MEMBENCH_LINE
+ *                   bytes in random order, so each load waits for the one
+ *                   before and the prefetcher can't help
+ *
+ * membench_run times the best of a number of passes with whatever clock
+ * the caller has, and membench_units says how much work a pass is: bytes
+ * moved for read, write and copy, loads for chase. The buffer can be any
+ * mapping (cached, uncached, device memory), which is the point: compare
+ * the same operation on different mappings of the same size.
+ */
+
+#ifndef __SHARED_MEMBENCH_H
+#define __SHARED_MEMBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    MEMBENCH_READ,
+    MEMBENCH_WRITE,
+    MEMBENCH_COPY,
+    MEMBENCH_CHASE,
+    MEMBENCH_NUM_OPS
+};
+
+static const char *const membench_op_names[MEMBENCH_NUM_OPS] = {
+    [MEMBENCH_READ] = "read",
+    [MEMBENCH_WRITE] = "write",
+    [MEMBENCH_COPY] = "copy",
+    [MEMBENCH_CHASE] = "chase",
+};
+
+/* Distance between the loads of the pointer chase. At least a cache line on
+ * every platform we run on. */
+#define MEMBENCH_LINE 64
+
+/* Returns the current time in the caller's ticks */
+typedef uint64_t (*membench_clock_t)(void *cookie);
+
+typedef volatile uintptr_t membench_word_t;
+
+static inline uintptr_t
+membench_read(membench_word_t *buf, size_t bytes)
+{
+    uintptr_t sum = 0;
+    size_t words = bytes / sizeof(uintptr_t);
+
+    for (size_t i = 0; i < words; i += 4) {
+        sum += buf[i] + buf[i + 1] + buf[i + 2] + buf[i + 3];
+    }
+    return sum;
+}
+
+static inline void
+membench_write(membench_word_t *buf, size_t bytes, uintptr_t value)
+{
+    size_t words = bytes / sizeof(uintptr_t);
+
+    for (size_t i = 0; i < words; i += 4) {
+        buf[i] = value;
+        buf[i + 1] = value;
+        buf[i + 2] = value;
+        buf[i + 3] = value;
+    }
+}
+
+static inline void
+membench_copy(membench_word_t *dst, membench_word_t *src, size_t bytes)
+{
+    size_t words = bytes / sizeof(uintptr_t);
+
+    for (size_t i = 0; i < words; i += 4) {
+        dst[i] = src[i];
+        dst[i + 1] = src[i + 1];
+        dst[i + 2] = src[i + 2];
+        dst[i + 3] = src[i + 3];
+    }
+}
+
+/* Link the lines of buf into a single random cycle. The first word of each
+ * line points to the next line, the second word holds the shuffled order
+ * while building it. */
+static inline void
+membench_chase_init(void *buf, size_t bytes)
+{
+    uintptr_t base = (uintptr_t) buf;
+    size_t lines = bytes / MEMBENCH_LINE;
+    uint32_t seed = 1;
+
+#define MEMBENCH_LINE_WORD(line, word) (((membench_word_t *) (base + (line) * MEMBENCH_LINE))[word])
+
+    for (size_t i = 0; i < lines; i++) {
+        MEMBENCH_LINE_WORD(i, 1) = i;
+    }
+    /* Sattolo's shuffle, which always gives a single cycle */
+    for (size_t i = lines - 1; i > 0; i--) {
+        seed = seed * 1103515245 + 12345;
+        size_t j = (seed >> 8) % i;
+        uintptr_t tmp = MEMBENCH_LINE_WORD(i, 1);
+        MEMBENCH_LINE_WORD(i, 1) = MEMBENCH_LINE_WORD(j, 1);
+        MEMBENCH_LINE_WORD(j, 1) = tmp;
+    }
+    for (size_t i = 0; i < lines; i++) {
+        uintptr_t from = MEMBENCH_LINE_WORD(i, 1);
+        uintptr_t to = MEMBENCH_LINE_WORD((i + 1) % lines, 1);
+        MEMBENCH_LINE_WORD(from, 0) = base + to * MEMBENCH_LINE;
+    }
+
+#undef MEMBENCH_LINE_WORD
+}
+
+/* Follow the chain from buf for loads loads. Returns where it ended, which
+ * the caller must use so the loads are not optimised away. */
+static inline uintptr_t
+membench_chase(void *buf, size_t loads)
+{
+    uintptr_t p = (uintptr_t) buf;
+
+    for (size_t i = 0; i < loads; i++) {
+        p = *(membench_word_t *) p;
+    }
+    return p;
+}
+
+/* Work done by one pass of op over a buffer of bytes */
+static inline size_t
+membench_units(int op, size_t bytes)
+{
+    switch (op) {
+    case MEMBENCH_COPY:
+        return bytes / 2;
+    case MEMBENCH_CHASE:
+        return bytes / MEMBENCH_LINE;
+    default:
+        return bytes;
+    }
+}
+
+/* Result of the passes, so the compiler can't drop them */
+static volatile uintptr_t membench_sink;
+
+/* Time op over buf, returning the ticks of the fastest of passes passes.
+ * One untimed pass comes first, to fault in and warm up the buffer. bytes
+ * must be a multiple of MEMBENCH_LINE. */
+static inline uint64_t
+membench_run(int op, void *buf, size_t bytes, int passes, membench_clock_t clock, void *cookie)
+{
+    membench_word_t *words = buf;
+    uint64_t best = UINT64_MAX;
+
+    if (op == MEMBENCH_CHASE) {
+        membench_chase_init(buf, bytes);
+    }
+
+    for (int i = 0; i <= passes; i++) {
+        uint64_t start = clock(cookie);
+        switch (op) {
+        case MEMBENCH_READ:
+            membench_sink = membench_read(words, bytes);
+            break;
+        case MEMBENCH_WRITE:
+            membench_write(words, bytes, i);
+            break;
+        case MEMBENCH_COPY:
+            membench_copy(words + bytes / 2 / sizeof(uintptr_t), words, bytes / 2);
+            break;
+        case MEMBENCH_CHASE:
+            membench_sink = membench_chase(buf, bytes / MEMBENCH_LINE);
+            break;
+        }
+        uint64_t ticks = clock(cookie) - start;
+
+        if (i > 0 && ticks < best) {
+            best = ticks;
+        }
+    }
+    return best;
+}
+
+#endif /* __SHARED_MEMBENCH_H */
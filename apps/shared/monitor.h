@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2015, Josef Mihalits
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *
+ */
+
+/*
+ * Top like view of which threads use the CPU.
+ *
+ * Give the monitor the threads to watch, then start it in a thread of its
+ * own, which must have a higher priority than all of them:
+ *
+ *   static monitor_t mon;
+ *   monitor_init(&mon);
+ *   monitor_add(&mon, "main", seL4_CapInitThreadTCB, 254);
+ *   monitor_start(&mon, &vka, &vspace, &simple, 255);
+ *
+ * The monitor thread wakes up APP_SHARED_MONITOR_HZ times a second on the
+ * default timer, and charges the tick to the thread that was running when
+ * the timer interrupt came, and every APP_SHARED_MONITOR_REFRESH seconds
+ * prints a table of the share of the CPU each thread got, since the last
+ * table and since the start:
+ *
+ *   monitor: 100 samples at 100 Hz, 3 threads
+ *   THREAD            PRI   CPU%  TOTAL%  STATE  IP
+ *   thread0           254   50.0    49.8  R      0804a1c3
+ *   thread1           254   50.0    49.8  R      0804a203
+ *   timer             200    0.0     0.1  B      0804f8a0
+ *   idle                     0.0     0.3
+ *
+ * This kernel has no accounting of the time each thread runs (the later
+ * benchmark kernels track it), so the monitor works out who was running
+ * from the state of the threads: a thread is blocked (B) if it is stopped
+ * at the trap instruction of a seL4_Wait or seL4_ReplyWait (the kernel
+ * saves the trap as the pc to restart it at), going by the system call
+ * number still in its saved registers, with its registers the same as at
+ * the last sample. Otherwise it is runnable (R). The tick is
+ * shared by the runnable threads of the highest priority, as the kernel
+ * would have scheduled them; if none is runnable the tick is idle.
+ *
+ * Other system calls are taken to return straight away, so a thread that
+ * polls with a tight loop of them (reading an I/O port, say) shows as
+ * runnable, and gets its full share. The price is that a thread blocked in
+ * a seL4_Send or seL4_Call to an endpoint shows as runnable too. Threads
+ * that are not given to the monitor are not seen at all, and neither is
+ * the monitor itself. The threads must share the monitor's address space,
+ * as it reads the code at their instruction pointers.
+ *
+ * With APP_SHARED_MONITOR_CLEAR the screen is cleared before each table,
+ * which redraws it in place on a terminal.
+ */
+
+#ifndef __SHARED_MONITOR_H
+#define __SHARED_MONITOR_H
+
+#include <autoconf.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sel4/sel4.h>
+
+#include <platsupport/timer.h>
+#include <sel4platsupport/plat/timer.h>
+#include <sel4utils/thread.h>
+#include <simple/simple.h>
+#include <utils/time.h>
+#include <utils/util.h>
+#include <vka/object.h>
+
+#ifndef MONITOR_MAX_THREADS
+#define MONITOR_MAX_THREADS 8
+#endif
+
+/* a tick is split into this many shares, which divides evenly between up
+ * to eight threads */
+#define MONITOR_SHARES 840
+
+typedef struct monitor_thread {
+    const char *name;
+    seL4_CPtr tcb;
+    uint8_t prio;
+    /* registers at the last sample */
+    seL4_UserContext regs;
+    bool runnable;
+    /* shares since the last table, and since the start */
+    uint32_t shares;
+    uint64_t total;
+} monitor_thread_t;
+
+typedef struct monitor {
+    monitor_thread_t threads[MONITOR_MAX_THREADS];
+    int num_threads;
+    /* idle shares, and samples, since the last table and since the start */
+    uint32_t idle;
+    uint64_t total_idle;
+    uint32_t samples;
+    uint64_t total_samples;
+    uint32_t errors;
+
+    seL4_timer_t *timer;
+    vka_object_t timer_aep;
+    sel4utils_thread_t thread;
+} monitor_t;
+
+static inline void
+monitor_init(monitor_t *mon)
+{
+    memset(mon, 0, sizeof(*mon));
+}
+
+/* Watch the thread tcb running at priority prio. Returns its index, or -1
+ * if there are too many */
+static inline int
+monitor_add(monitor_t *mon, const char *name, seL4_CPtr tcb, uint8_t prio)
+{
+    if (mon->num_threads == MONITOR_MAX_THREADS) {
+        return -1;
+    }
+    monitor_thread_t *t = &mon->threads[mon->num_threads];
+    t->name = name;
+    t->tcb = tcb;
+    t->prio = prio;
+    return mon->num_threads++;
+}
+
+static inline seL4_Word
+monitor_ip(seL4_UserContext *regs)
+{
+#if defined(ARCH_ARM)
+    return regs->pc;
+#elif defined(CONFIG_X86_64)
+    return regs->rip;
+#elif defined(ARCH_IA32)
+    return regs->eip;
+#else
+#error "Unknown architecture."
+#endif
+}
+
+/* The system call number, as passed in to the trap */
+static inline seL4_Word
+monitor_syscall(seL4_UserContext *regs)
+{
+#if defined(ARCH_ARM)
+    return regs->r7;
+#elif defined(CONFIG_X86_64)
+    return regs->rdx;
+#elif defined(ARCH_IA32)
+    return regs->eax;
+#else
+#error "Unknown architecture."
+#endif
+}
+
+/* Is ip at a system call trap? A thread in a system call restarts at the
+ * trap, so that is the ip in its saved registers. */
+static inline bool
+monitor_at_trap(seL4_Word ip)
+{
+#if defined(ARCH_ARM)
+    /* svc, with any condition */
+    return (*(uint32_t *) ip & 0x0f000000) == 0x0f000000;
+#elif defined(CONFIG_X86_64)
+    /* syscall */
+    return *(uint16_t *) ip == 0x050f;
+#else
+    /* sysenter */
+    return *(uint16_t *) ip == 0x340f;
+#endif
+}
+
+/* Is the thread stopped in a system call that blocks until someone else
+ * wakes it up? */
+static inline bool
+monitor_blocked(seL4_UserContext *regs, seL4_UserContext *last)
+{
+    if (monitor_ip(regs) < sizeof(uint32_t)) {
+        /* never started */
+        return true;
+    }
+    if (!monitor_at_trap(monitor_ip(regs)) || memcmp(regs, last, sizeof(*regs)) != 0) {
+        return false;
+    }
+    seL4_Word syscall = monitor_syscall(regs);
+    return syscall == (seL4_Word) seL4_SysWait || syscall == (seL4_Word) seL4_SysReplyWait;
+}
+
+/* Sample every thread, and charge one tick */
+static inline void
+monitor_sample(monitor_t *mon)
+{
+    int top = -1;
+    int num_top = 0;
+
+    for (int i = 0; i < mon->num_threads; i++) {
+        monitor_thread_t *t = &mon->threads[i];
+        seL4_UserContext regs;
+
+        int error = seL4_TCB_ReadRegisters(t->tcb, false, 0,
+                                           sizeof(regs) / sizeof(seL4_Word), &regs);
+        if (error != seL4_NoError) {
+            mon->errors++;
+            t->runnable = false;
+            continue;
+        }
+        t->runnable = !monitor_blocked(&regs, &t->regs);
+        t->regs = regs;
+
+        if (t->runnable && t->prio > top) {
+            top = t->prio;
+            num_top = 0;
+        }
+        if (t->runnable && t->prio == top) {
+            num_top++;
+        }
+    }
+
+    if (num_top == 0) {
+        mon->idle += MONITOR_SHARES;
+    } else {
+        for (int i = 0; i < mon->num_threads; i++) {
+            monitor_thread_t *t = &mon->threads[i];
+            if (t->runnable && t->prio == top) {
+                t->shares += MONITOR_SHARES / num_top;
+            }
+        }
+    }
+    mon->samples++;
+}
+
+/* shares as a percentage of samples, to one decimal place */
+static inline void
+monitor_print_percent(uint64_t shares, uint64_t samples, int width)
+{
+    uint64_t permille = samples ? (shares * 1000 + samples * MONITOR_SHARES / 2) /
+                        (samples * MONITOR_SHARES) : 0;
+    printf("%*llu.%llu", width - 2, (unsigned long long) permille / 10,
+           (unsigned long long) permille % 10);
+}
+
+/* Print the table, and start the next period */
+static inline void
+monitor_print(monitor_t *mon)
+{
+    mon->total_samples += mon->samples;
+    mon->total_idle += mon->idle;
+
+#ifdef CONFIG_APP_SHARED_MONITOR_CLEAR
+    printf("\033[2J\033[H");
+#endif
+    printf("monitor: %u samples at %d Hz, %d threads", mon->samples,
+           CONFIG_APP_SHARED_MONITOR_HZ, mon->num_threads);
+    if (mon->errors > 0) {
+        printf(", %u failed reads", mon->errors);
+    }
+    printf("\n%-16s %4s %6s %7s  %-5s  %s\n", "THREAD", "PRI", "CPU%", "TOTAL%", "STATE", "IP");
+
+    for (int i = 0; i < mon->num_threads; i++) {
+        monitor_thread_t *t = &mon->threads[i];
+        t->total += t->shares;
+        printf("%-16s %4u ", t->name, t->prio);
+        monitor_print_percent(t->shares, mon->samples, 6);
+        printf(" ");
+        monitor_print_percent(t->total, mon->total_samples, 7);
+        printf("  %-5s  %08lx\n", t->runnable ? "R" : "B", (unsigned long) monitor_ip(&t->regs));
+        t->shares = 0;
+    }
+    printf("%-16s %4s ", "idle", "");
+    monitor_print_percent(mon->idle, mon->samples, 6);
+    printf(" ");
+    monitor_print_percent(mon->total_idle, mon->total_samples, 7);
+    printf("\n");
+
+    mon->idle = 0;
+    mon->samples = 0;
+    mon->errors = 0;
+}
+
+static inline void
+monitor_run(void *arg0, void *arg1 UNUSED, void *ipc_buf UNUSED)
+{
+    monitor_t *mon = arg0;
+    uint32_t refresh = CONFIG_APP_SHARED_MONITOR_HZ * CONFIG_APP_SHARED_MONITOR_REFRESH;
+
+    UNUSED int error = timer_periodic(mon->timer->timer, NS_IN_S / CONFIG_APP_SHARED_MONITOR_HZ);
+    assert(error == 0);
+    timer_start(mon->timer->timer);
+
+    for (;;) {
+        seL4_Wait(mon->timer_aep.cptr, NULL);
+        monitor_sample(mon);
+        sel4_timer_handle_single_irq(mon->timer);
+
+        if (mon->samples == refresh) {
+            monitor_print(mon);
+        }
+    }
+}
+
+/* Start the monitor thread at priority prio, with the default timer. Add
+ * the threads to watch first. */
+static inline int
+monitor_start(monitor_t *mon, vka_t *vka, vspace_t *vspace, simple_t *simple, uint8_t prio)
+{
+    int error = vka_alloc_async_endpoint(vka, &mon->timer_aep);
+    if (error) {
+        return error;
+    }
+    mon->timer = sel4platsupport_get_default_timer(vka, vspace, simple, mon->timer_aep.cptr);
+    if (mon->timer == NULL) {
+        return -1;
+    }
+
+    error = sel4utils_configure_thread(vka, vspace, vspace, seL4_CapNull, prio,
+                                       simple_get_cnode(simple), seL4_NilData, &mon->thread);
+    if (error) {
+        return error;
+    }
+    return sel4utils_start_thread(&mon->thread, monitor_run, mon, NULL, 1);
+}
+
+#endif /* __SHARED_MONITOR_H */
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2015, Josef Mihalits
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *
+ */
+
+/*
+ * Hardware performance counters, read from user level.
+ *
+ * Counts cycles, instructions, data cache misses and data TLB misses around
+ * a region of code:
+ *
+ *   pmu_counts_t counts;
+ *   pmu_init();
+ *   PMU_MEASURE(&counts, do_something());
+ *   printf("cycles=%llu instructions=%llu\n", counts.cycles,
+ *          counts.events[PMU_INSTRUCTIONS]);
+ *
+ * ARMv7 (sabre, odroid): the cycle counter and three event counters.
+ * ARMv6 (kzm): not supported. The ARM1136 system performance monitor can
+ *   only be read in privileged modes, and unlike PMUSERENR on ARMv7 there
+ *   is nothing the kernel can set to let user level at it.
+ * x86: the TSC for cycles and fixed counter 0 for instructions. Programming
+ *   the general purpose counters needs ring 0, so cache and TLB misses are
+ *   not counted.
+ *
+ * pmu_cycles reads just the cycle counter, for when reading every counter
+ * costs too much.
+ *
+ * Counters on ARM are 32 bits wide, so keep measured regions short enough
+ * not to wrap twice. Use pmu_supported to check which events are counted,
+ * the rest read as zero. Everything reads as zero unless APP_SHARED_PMU is
+ * set, see apps/shared/Kconfig.
+ */
+
+#ifndef __SHARED_PMU_H
+#define __SHARED_PMU_H
+
+#include <autoconf.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+    PMU_INSTRUCTIONS,
+    PMU_CACHE_MISSES,
+    PMU_TLB_MISSES,
+    PMU_NUM_EVENTS
+};
+
+typedef struct pmu_counts {
+    uint64_t cycles;
+    uint64_t events[PMU_NUM_EVENTS];
+} pmu_counts_t;
+
+/* Format and arguments for printing counts as key=value pairs */
+#define PMU_FMT "cycles=%llu instructions=%llu cache_misses=%llu tlb_misses=%llu"
+#define PMU_ARGS(c) (c)->cycles, (c)->events[PMU_INSTRUCTIONS], \
+                    (c)->events[PMU_CACHE_MISSES], (c)->events[PMU_TLB_MISSES]
+
+#ifdef CONFIG_APP_SHARED_PMU
+
+#if defined(CONFIG_ARCH_ARM_V7A)
+
+/* ARMv7 architectural event numbers. The Cortex-A9 does not implement
+ * instructions architecturally executed, use its instructions renamed
+ * event instead. */
+#ifdef CONFIG_ARM_CORTEX_A9
+#define PMU_V7_INSTRUCTIONS 0x68
+#else
+#define PMU_V7_INSTRUCTIONS 0x08
+#endif
+#define PMU_V7_L1D_CACHE_REFILL 0x03
+#define PMU_V7_L1D_TLB_REFILL   0x05
+
+/* PMCR: enable, reset the event counters and the cycle counter */
+#define PMU_V7_PMCR_ENABLE (1 << 0)
+#define PMU_V7_PMCR_RESET  (3 << 1)
+#define PMU_V7_CYCLE_COUNTER_ENABLE (1u << 31)
+
+static inline void
+pmu_v7_select(uint32_t counter, uint32_t event)
+{
+    asm volatile("mcr p15, 0, %0, c9, c12, 5" :: "r"(counter));
+    asm volatile("mcr p15, 0, %0, c9, c13, 1" :: "r"(event));
+}
+
+static inline uint32_t
+pmu_v7_read_counter(uint32_t counter)
+{
+    uint32_t value;
+    asm volatile("mcr p15, 0, %0, c9, c12, 5" :: "r"(counter));
+    asm volatile("mrc p15, 0, %0, c9, c13, 2" : "=r"(value));
+    return value;
+}
+
+static inline void
+pmu_init(void)
+{
+    /* event counter i counts event i */
+    pmu_v7_select(PMU_INSTRUCTIONS, PMU_V7_INSTRUCTIONS);
+    pmu_v7_select(PMU_CACHE_MISSES, PMU_V7_L1D_CACHE_REFILL);
+    pmu_v7_select(PMU_TLB_MISSES, PMU_V7_L1D_TLB_REFILL);
+
+    uint32_t enable = PMU_V7_CYCLE_COUNTER_ENABLE | ((1 << PMU_NUM_EVENTS) - 1);
+    asm volatile("mcr p15, 0, %0, c9, c12, 1" :: "r"(enable));
+    asm volatile("mcr p15, 0, %0, c9, c12, 0" :: "r"(PMU_V7_PMCR_ENABLE | PMU_V7_PMCR_RESET));
+}
+
+static inline bool
+pmu_supported(int event)
+{
+    return true;
+}
+
+static inline uint64_t
+pmu_cycles(void)
+{
+    uint32_t ccnt;
+    asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(ccnt));
+    return ccnt;
+}
+
+static inline void
+pmu_read(pmu_counts_t *counts)
+{
+    counts->cycles = pmu_cycles();
+    for (int i = 0; i < PMU_NUM_EVENTS; i++) {
+        counts->events[i] = pmu_v7_read_counter(i);
+    }
+}
+
+#elif defined(CONFIG_ARCH_IA32) || defined(CONFIG_X86_64)
+
+/* rdpmc reads fixed function counter n with ecx = (1 << 30) | n */
+#define PMU_X86_FIXED_INSTRUCTIONS ((1u << 30) | 0)
+
+static inline uint64_t
+pmu_x86_rdpmc(uint32_t counter)
+{
+    uint32_t low, high;
+    asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+    return ((uint64_t) high << 32) | low;
+}
+
+static inline void
+pmu_init(void)
+{
+    /* the fixed counters can only be programmed by the kernel */
+}
+
+static inline bool
+pmu_supported(int event)
+{
+    return event == PMU_INSTRUCTIONS;
+}
+
+static inline uint64_t
+pmu_cycles(void)
+{
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t) high << 32) | low;
+}
+
+static inline void
+pmu_read(pmu_counts_t *counts)
+{
+    counts->cycles = pmu_cycles();
+    counts->events[PMU_INSTRUCTIONS] = pmu_x86_rdpmc(PMU_X86_FIXED_INSTRUCTIONS);
+    counts->events[PMU_CACHE_MISSES] = 0;
+    counts->events[PMU_TLB_MISSES] = 0;
+}
+
+#else
+#error "APP_SHARED_PMU is not supported on this architecture"
+#endif
+
+/* ARM counters are 32 bits wide */
+#if defined(CONFIG_ARCH_ARM)
+#define PMU_COUNTER_MASK 0xffffffffull
+#else
+#define PMU_COUNTER_MASK 0xffffffffffffffffull
+#endif
+
+#else /* !CONFIG_APP_SHARED_PMU */
+
+#define PMU_COUNTER_MASK 0
+
+static inline void
+pmu_init(void)
+{
+}
+
+static inline bool
+pmu_supported(int event)
+{
+    return false;
+}
+
+static inline uint64_t
+pmu_cycles(void)
+{
+    return 0;
+}
+
+static inline void
+pmu_read(pmu_counts_t *counts)
+{
+    counts->cycles = 0;
+    for (int i = 0; i < PMU_NUM_EVENTS; i++) {
+        counts->events[i] = 0;
+    }
+}
+
+#endif /* CONFIG_APP_SHARED_PMU */
+
+/* end - start cycles, as read by pmu_cycles, allowing for a wrap */
+static inline uint64_t
+pmu_cycles_diff(uint64_t start, uint64_t end)
+{
+    return (end - start) & PMU_COUNTER_MASK;
+}
+
+/* result = end - start, allowing for each counter having wrapped once */
+static inline void
+pmu_diff(pmu_counts_t *start, pmu_counts_t *end, pmu_counts_t *result)
+{
+    result->cycles = (end->cycles - start->cycles) & PMU_COUNTER_MASK;
+    for (int i = 0; i < PMU_NUM_EVENTS; i++) {
+        result->events[i] = (end->events[i] - start->events[i]) & PMU_COUNTER_MASK;
+    }
+}
+
+/* Count the events while running code */
+#define PMU_MEASURE(counts, code) do { \
+        pmu_counts_t _pmu_start, _pmu_end; \
+        pmu_read(&_pmu_start); \
+        code; \
+        pmu_read(&_pmu_end); \
+        pmu_diff(&_pmu_start, &_pmu_end, counts); \
+    } while (0)
+
+#endif /* __SHARED_PMU_H */
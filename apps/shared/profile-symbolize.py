@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2015, Josef Mihalits
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+#
+
+#
+# Turn the "PR&" histograms printed by profiler_dump (see profiler.h) into
+# a profile per function, with the symbols of the app's ELF file:
+#
+#   profile-symbolize.py images/threads-image-ia32-pc99 console.log
+#
+# The samples are the user level instruction pointers that
+# seL4_TCB_ReadRegisters returns, so there are no kernel addresses among
+# them: time a thread spends in the kernel is charged to the address it
+# restarts at, which is its system call trap instruction itself. All the
+# histograms in the log are added up, one profile is printed per target
+# thread.
+#
+# The symbols are read with nm, from TOOLPREFIX (default arm-none-eabi-).
+#
+
+from __future__ import print_function
+
+import sys
+import os
+import re
+import bisect
+import argparse
+from subprocess import Popen, PIPE
+
+SAMPLE = re.compile(r'PR& (\d+) ([0-9a-f]+) (\d+)\s*$')
+TOTALS = re.compile(r'PR& samples=(\d+) targets=(\d+) dropped=(\d+) errors=(\d+)')
+
+
+def get_tool(toolname):
+    default_prefix = 'arm-none-eabi-'
+
+    return os.environ.get('TOOLPREFIX', default_prefix) + toolname
+
+
+class Symbols(object):
+    """Find the symbol an address is in, from a list of (address, size, name),
+    where the size is None if not known"""
+
+    def __init__(self, symbols):
+        symbols = sorted(set(symbols), key=lambda s: s[0])
+        self.addrs = [a for a, _, _ in symbols]
+        self.symbols = symbols
+        # nothing past the end of the last symbol with a size
+        ends = [a + size for a, size, _ in symbols if size is not None]
+        self.end = max(ends) if ends else None
+
+    def lookup(self, addr):
+        """(name, offset) of the nearest symbol at or below addr, or None"""
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0 or (self.end is not None and addr >= self.end):
+            return None
+        start, size, name = self.symbols[i]
+        if size is not None and addr >= start + size:
+            return None
+        return name, addr - start
+
+
+def nm_symbols(filename):
+    """Code symbols of an ELF file"""
+    proc = Popen([get_tool('nm'), '--defined-only', '-S', filename], stdout=PIPE,
+                 universal_newlines=True)
+    symbols = []
+    for line in proc.stdout:
+        # the size is only there for symbols that have one
+        fields = line.split()
+        if len(fields) == 4 and fields[2] in 'tTwW':
+            symbols.append((int(fields[0], 16), int(fields[1], 16), fields[3]))
+        elif len(fields) == 3 and fields[1] in 'tTwW':
+            symbols.append((int(fields[0], 16), None, fields[2]))
+    if proc.wait() != 0:
+        raise OSError('%s failed on %s' % (get_tool('nm'), filename))
+    return symbols
+
+
+def read_samples(lines):
+    """Map target to {address: samples}, and the totals of all the dumps"""
+    targets = {}
+    totals = [0, 0, 0]
+    for line in lines:
+        start = line.find('PR& ')
+        if start < 0:
+            continue
+        m = SAMPLE.match(line[start:])
+        if m:
+            target, addr, count = int(m.group(1)), int(m.group(2), 16), int(m.group(3))
+            hist = targets.setdefault(target, {})
+            hist[addr] = hist.get(addr, 0) + count
+            continue
+        m = TOTALS.match(line[start:])
+        if m:
+            totals[0] += int(m.group(1))
+            totals[1] += int(m.group(3))
+            totals[2] += int(m.group(4))
+    return targets, totals
+
+
+def print_profile(target, hist, symbols, args):
+    total = sum(hist.values())
+    functions = {}
+    places = []
+    for addr, count in hist.items():
+        found = symbols.lookup(addr)
+        if found is None:
+            function = '0x%x' % addr
+            place = function
+        else:
+            function = found[0]
+            place = '%s+0x%x' % found
+        functions[function] = functions.get(function, 0) + count
+        places.append((count, addr, place))
+
+    print('target %d: %d samples' % (target, total))
+    print('%10s %7s  %s' % ('samples', '%', 'function'))
+    for function, count in sorted(functions.items(), key=lambda x: (-x[1], x[0]))[:args.functions]:
+        print('%10d %6.2f%%  %s' % (count, 100.0 * count / total, function))
+    print()
+    print('%10s %7s  %-10s  %s' % ('samples', '%', 'address', 'where'))
+    for count, addr, place in sorted(places, key=lambda x: (-x[0], x[1]))[:args.top]:
+        print('%10d %6.2f%%  %-10x  %s' % (count, 100.0 * count / total, addr, place))
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Symbolize the histograms printed by profiler.h')
+    parser.add_argument('elf', help='ELF file of the app that was profiled')
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin,
+                        help='console output of the app (default: stdin)')
+    parser.add_argument('--functions', type=int, default=20,
+                        help='functions to print per target (default: %(default)s)')
+    parser.add_argument('--top', type=int, default=10,
+                        help='addresses to print per target (default: %(default)s)')
+    args = parser.parse_args()
+
+    symbols = Symbols(nm_symbols(args.elf))
+
+    targets, totals = read_samples(args.log)
+    if not targets:
+        print('no profiler records in the log', file=sys.stderr)
+        return 1
+
+    print('%d samples, %d dropped from a full histogram, %d failed reads' % tuple(totals))
+    print()
+    for target in sorted(targets):
+        print_profile(target, targets[target], symbols, args)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
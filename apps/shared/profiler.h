@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2015, Josef Mihalits
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *
+ */
+
+/*
+ * Statistical sampling profiler.
+ *
+ * A profiler thread, running at a higher priority than the threads it
+ * profiles, wakes up on a periodic timer and reads the instruction pointer
+ * of each target TCB with seL4_TCB_ReadRegisters. As the profiler has just
+ * preempted them, that is where the targets were running. It comes from
+ * the saved user context, so a target in the kernel, blocked or not, is
+ * seen at its restart address, which is the system call trap instruction
+ * itself. The samples go into a histogram per target and address, with no
+ * help from, or instrumentation of, the targets:
+ *
+ *   profiler_init(&prof);
+ *   profiler_add_target(&prof, tcb);
+ *   for (;;) {
+ *       seL4_Wait(timer_aep, NULL);
+ *       profiler_sample(&prof);
+ *       sel4_timer_handle_single_irq(timer);
+ *   }
+ *   ...
+ *   profiler_dump(&prof);
+ *
+ * profiler_dump prints one "PR&" line per target and address, which
+ * apps/shared/profile-symbolize.py turns into a profile per function with
+ * the symbols of the app's ELF file.
+ *
+ * The histogram is a fixed size hash table of PROFILER_BUCKETS entries;
+ * samples at new addresses are dropped, and counted, once it is full.
+ */
+
+#ifndef __SHARED_PROFILER_H
+#define __SHARED_PROFILER_H
+
+#include <autoconf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sel4/sel4.h>
+
+/* distinct (target, address) pairs kept, a power of two up to 65536 */
+#ifndef PROFILER_BUCKETS
+#define PROFILER_BUCKETS 4096
+#endif
+
+#ifndef PROFILER_MAX_TARGETS
+#define PROFILER_MAX_TARGETS 8
+#endif
+
+typedef struct profiler_bucket {
+    seL4_Word ip;
+    uint32_t target;
+    uint32_t count;
+} profiler_bucket_t;
+
+typedef struct profiler {
+    seL4_CPtr targets[PROFILER_MAX_TARGETS];
+    int num_targets;
+    /* samples taken, dropped because the table was full, and failed reads */
+    uint32_t samples;
+    uint32_t dropped;
+    uint32_t errors;
+    profiler_bucket_t buckets[PROFILER_BUCKETS];
+} profiler_t;
+
+static inline void
+profiler_init(profiler_t *prof)
+{
+    memset(prof, 0, sizeof(*prof));
+}
+
+/* Returns the index of the target, or -1 if there are too many */
+static inline int
+profiler_add_target(profiler_t *prof, seL4_CPtr tcb)
+{
+    if (prof->num_targets == PROFILER_MAX_TARGETS) {
+        return -1;
+    }
+    prof->targets[prof->num_targets] = tcb;
+    return prof->num_targets++;
+}
+
+/* The instruction pointer of tcb, which is the first register */
+static inline int
+profiler_read_ip(seL4_CPtr tcb, seL4_Word *ip)
+{
+    seL4_UserContext regs;
+    int error = seL4_TCB_ReadRegisters(tcb, false, 0, 1, &regs);
+
+#if defined(ARCH_ARM)
+    *ip = regs.pc;
+#elif defined(CONFIG_X86_64)
+    *ip = regs.rip;
+#elif defined(ARCH_IA32)
+    *ip = regs.eip;
+#else
+#error "Unknown architecture."
+#endif
+    return error;
+}
+
+static inline void
+profiler_count(profiler_t *prof, uint32_t target, seL4_Word ip)
+{
+    /* Fibonacci hashing (the high bits, as the low bits of aligned
+     * addresses are all zero), then linear probing */
+    uint32_t i = (((uint32_t) ip * 2654435761u) >> 16) & (PROFILER_BUCKETS - 1);
+
+    for (int probes = 0; probes < PROFILER_BUCKETS; probes++) {
+        profiler_bucket_t *b = &prof->buckets[i];
+        if (b->count == 0) {
+            b->ip = ip;
+            b->target = target;
+            b->count = 1;
+            return;
+        }
+        if (b->ip == ip && b->target == target) {
+            b->count++;
+            return;
+        }
+        i = (i + 1) & (PROFILER_BUCKETS - 1);
+    }
+    prof->dropped++;
+}
+
+/* Take one sample of every target */
+static inline void
+profiler_sample(profiler_t *prof)
+{
+    for (int t = 0; t < prof->num_targets; t++) {
+        seL4_Word ip;
+        if (profiler_read_ip(prof->targets[t], &ip) != seL4_NoError) {
+            prof->errors++;
+            continue;
+        }
+        profiler_count(prof, t, ip);
+    }
+    prof->samples++;
+}
+
+/* Print the histogram, then forget it */
+static inline void
+profiler_dump(profiler_t *prof)
+{
+    printf("PR& samples=%u targets=%d dropped=%u errors=%u\n", prof->samples,
+           prof->num_targets, prof->dropped, prof->errors);
+    for (int i = 0; i < PROFILER_BUCKETS; i++) {
+        profiler_bucket_t *b = &prof->buckets[i];
+        if (b->count > 0) {
+            printf("PR& %u %lx %u\n", b->target, (unsigned long) b->ip, b->count);
+        }
+    }
+    printf("PR& end\n");
+
+    int num_targets = prof->num_targets;
+    seL4_CPtr targets[PROFILER_MAX_TARGETS];
+    memcpy(targets, prof->targets, sizeof(targets));
+    profiler_init(prof);
+    memcpy(prof->targets, targets, sizeof(targets));
+    prof->num_targets = num_targets;
+}
+
+#endif /* __SHARED_PROFILER_H */
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2015, Josef Mihalits
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *
+ */
+
+/*
+ * Per call site accounting of system calls.
+ *
+ * Wrap a call to count how often it is made, and the cycles it takes:
+ *
+ *   err = SYSCALL_STATS(seL4_IRQHandler_Ack, dev->handler.capPtr);
+ *
+ * Every wrapped call site gets its own static record, placed in the
+ * _syscall_sites section so that syscall_stats_dump can find them all
+ * without any registration. The dump prints one "SB&" record per call site,
+ * then one per call summed over its sites:
+ *
+ *   SB& syscall call=seL4_IRQHandler_Ack site=main.c:165 : count=12 cycles=8400 mean_cycles=700
+ *   SB& syscall call=seL4_IRQHandler_Ack site=all : count=13 cycles=9100 mean_cycles=700
+ *
+ * Any function that returns a value can be wrapped, so library calls that
+ * end in a system call (such as ps_io_port_in) are counted the same way.
+ *
+ * Wrap calls that block (seL4_Wait, seL4_ReplyWait, a seL4_Call to a server)
+ * with SYSCALL_STATS_WAIT instead. Their cycles are mostly time spent
+ * waiting for someone else, not the cost of the call, so they are reported
+ * as wait_cycles and kept apart from the cycles of the other calls:
+ *
+ *   SB& syscall call=seL4_Wait site=main.c:231 : count=5 wait_cycles=91200000 mean_wait_cycles=18240000
+ *
+ * Cycles come from pmu.h and read as zero unless APP_SHARED_PMU is set, the
+ * counts are always kept. The records are not locked, so only wrap calls
+ * made by one thread.
+ *
+ * Unless APP_SHARED_SYSCALL_STATS is set, SYSCALL_STATS and
+ * SYSCALL_STATS_WAIT are just the call.
+ */
+
+#ifndef __SHARED_SYSCALL_STATS_H
+#define __SHARED_SYSCALL_STATS_H
+
+#include <autoconf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pmu.h"
+
+typedef struct syscall_site {
+    const char *call;
+    const char *file;
+    int line;
+    /* cycles are time blocked, not the cost of the call */
+    bool blocking;
+    uint32_t count;
+    uint64_t cycles;
+} syscall_site_t;
+
+#ifdef CONFIG_APP_SHARED_SYSCALL_STATS
+
+/* the linker provides these for the section, if there are any call sites.
+ * The sites are read as an array, so they are given their natural
+ * alignment, which stops the compiler padding them apart. */
+extern syscall_site_t __start__syscall_sites[] __attribute__((weak));
+extern syscall_site_t __stop__syscall_sites[] __attribute__((weak));
+
+#define SYSCALL_STATS_SITE(is_blocking, fn, ...) ({ \
+        static syscall_site_t _site \
+            __attribute__((used, section("_syscall_sites"), aligned(__alignof__(syscall_site_t)))) = { \
+            .call = #fn, .file = __FILE__, .line = __LINE__, .blocking = is_blocking \
+        }; \
+        uint64_t _site_start = pmu_cycles(); \
+        __typeof__(fn(__VA_ARGS__)) _site_ret = fn(__VA_ARGS__); \
+        _site.cycles += pmu_cycles_diff(_site_start, pmu_cycles()); \
+        _site.count++; \
+        _site_ret; \
+    })
+
+#define SYSCALL_STATS(fn, ...) SYSCALL_STATS_SITE(false, fn, __VA_ARGS__)
+#define SYSCALL_STATS_WAIT(fn, ...) SYSCALL_STATS_SITE(true, fn, __VA_ARGS__)
+
+static inline void
+syscall_stats_reset(void)
+{
+    for (syscall_site_t *site = __start__syscall_sites; site < __stop__syscall_sites; site++) {
+        site->count = 0;
+        site->cycles = 0;
+    }
+}
+
+static inline void
+syscall_stats_print(const char *call, const char *file, int line, bool blocking, uint32_t count,
+                    uint64_t cycles)
+{
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+
+    printf("SB& syscall call=%s site=", call);
+    if (line > 0) {
+        printf("%s:%d", base, line);
+    } else {
+        printf("all");
+    }
+    printf(" : count=%u %scycles=%llu mean_%scycles=%llu\n", count, blocking ? "wait_" : "",
+           cycles, blocking ? "wait_" : "", count ? cycles / count : 0);
+}
+
+/* Print the counts for every call site that was used, then for every call */
+static inline void
+syscall_stats_dump(void)
+{
+    syscall_site_t *sites = __start__syscall_sites;
+    int num_sites = __stop__syscall_sites - __start__syscall_sites;
+
+    for (int i = 0; i < num_sites; i++) {
+        if (sites[i].count > 0) {
+            syscall_stats_print(sites[i].call, sites[i].file, sites[i].line,
+                                sites[i].blocking, sites[i].count, sites[i].cycles);
+        }
+    }
+
+    /* there are only ever a handful of sites, so total each call the first
+     * time it is seen, keeping blocking sites apart */
+    for (int i = 0; i < num_sites; i++) {
+        uint32_t count = 0;
+        uint64_t cycles = 0;
+        bool first = true;
+
+        for (int j = 0; j < num_sites; j++) {
+            if (strcmp(sites[i].call, sites[j].call) != 0 ||
+                    sites[i].blocking != sites[j].blocking) {
+                continue;
+            }
+            if (j < i) {
+                first = false;
+                break;
+            }
+            count += sites[j].count;
+            cycles += sites[j].cycles;
+        }
+        if (first && count > 0) {
+            syscall_stats_print(sites[i].call, "", 0, sites[i].blocking, count, cycles);
+        }
+    }
+}
+
+#else /* !CONFIG_APP_SHARED_SYSCALL_STATS */
+
+#define SYSCALL_STATS(fn, ...) fn(__VA_ARGS__)
+#define SYSCALL_STATS_WAIT(fn, ...) fn(__VA_ARGS__)
+
+static inline void
+syscall_stats_reset(void)
+{
+}
+
+static inline void
+syscall_stats_dump(void)
+{
+    printf("syscall accounting is off, set APP_SHARED_SYSCALL_STATS\n");
+}
+
+#endif /* CONFIG_APP_SHARED_SYSCALL_STATS */
+
+#endif /* __SHARED_SYSCALL_STATS_H */
@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2015, Josef Mihalits
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+#
+
+#
+# Decode the "TR&" records printed by trace_drain and trace_dump (see
+# trace.h) back into text, with the format strings from the _trace_fmt
+# section of the app's ELF file:
+#
+#   trace-decode.py images/keyboard4-image-ia32-pc99 console.log
+#
+# Other console output is passed through unchanged, so the trace appears
+# where it was printed. Each event is printed with its sequence number and
+# the cycles since the event before it (zero unless the app was built with
+# APP_SHARED_PMU).
+#
+
+from __future__ import print_function
+
+import sys
+import re
+import struct
+import argparse
+
+RECORD = re.compile(r'TR& ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+)\s*$')
+LOST = re.compile(r'TR& lost (\d+)')
+CONVERSION = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t)?([diouxXcsp%])')
+
+
+class Elf(object):
+    """The loaded sections of an ELF file, for reading strings by address"""
+
+    def __init__(self, filename):
+        with open(filename, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF':
+            raise ValueError('%s is not an ELF file' % filename)
+        self.word_bits = 64 if self.data[4:5] == b'\x02' else 32
+        endian = '<' if self.data[5:6] == b'\x01' else '>'
+
+        if self.word_bits == 32:
+            shoff, = struct.unpack_from(endian + 'I', self.data, 0x20)
+            shentsize, shnum, shstrndx = struct.unpack_from(endian + 'HHH', self.data, 0x2e)
+            section = endian + 'IIIIIIIIII'
+        else:
+            shoff, = struct.unpack_from(endian + 'Q', self.data, 0x28)
+            shentsize, shnum, shstrndx = struct.unpack_from(endian + 'HHH', self.data, 0x3a)
+            section = endian + 'IIQQQQIIQQ'
+
+        headers = [struct.unpack_from(section, self.data, shoff + i * shentsize) for i in range(shnum)]
+        names_offset = headers[shstrndx][4]
+
+        # (address, size, file offset) of every section with contents in the file
+        self.sections = []
+        self.by_name = {}
+        for header in headers:
+            name, sh_type, flags, addr, offset, size = header[:6]
+            name = self.cstring(names_offset + name)
+            self.by_name[name] = (addr, size, offset)
+            # SHT_NOBITS (.bss) has no contents
+            if addr and sh_type != 8:
+                self.sections.append((addr, size, offset))
+
+    def cstring(self, offset):
+        end = self.data.index(b'\0', offset)
+        return self.data[offset:end].decode('latin-1')
+
+    def string_at(self, addr):
+        for start, size, offset in self.sections:
+            if start <= addr < start + size:
+                return self.cstring(offset + addr - start)
+        return None
+
+
+def format_event(elf, fmt, words):
+    """printf fmt with the argument words of a record"""
+    words = list(words)
+    mask = (1 << elf.word_bits) - 1
+
+    def convert(m):
+        flags, length, conv = m.groups()
+        if conv == '%':
+            return '%'
+        if not words:
+            return '<missing>'
+        value = words.pop(0)
+        if length == 'll' and elf.word_bits == 32:
+            value |= (words.pop(0) if words else 0) << 32
+            bits = 64
+        else:
+            bits = elf.word_bits
+        if conv == 's':
+            s = elf.string_at(value)
+            return ('%' + flags + 's') % (s if s is not None else '<0x%x>' % value)
+        if conv == 'p':
+            return '0x%x' % value
+        if conv == 'c':
+            return chr(value & 0xff)
+        if conv in 'di':
+            value &= (1 << bits) - 1
+            if value >> (bits - 1):
+                value -= 1 << bits
+            conv = 'd'
+        elif conv == 'u':
+            conv = 'd'
+        else:
+            value &= mask if bits == elf.word_bits else (1 << 64) - 1
+        return ('%' + flags + conv) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode the trace records printed by trace.h')
+    parser.add_argument('elf', help='ELF file of the app that printed the records')
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin,
+                        help='console output of the app (default: stdin)')
+    parser.add_argument('--only', action='store_true', help='drop all output other than the records')
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    if '_trace_fmt' not in elf.by_name:
+        print('%s has no _trace_fmt section, was it built with APP_SHARED_TRACE?' % args.elf,
+              file=sys.stderr)
+        return 1
+
+    last_cycles = None
+    for line in args.log:
+        start = line.find('TR& ')
+        if start < 0:
+            if not args.only:
+                sys.stdout.write(line)
+            continue
+
+        lost = LOST.match(line[start:])
+        if lost:
+            print('[%s records lost]' % lost.group(1))
+            continue
+        record = RECORD.match(line[start:])
+        if record is None:
+            continue
+        fields = [int(x, 16) for x in record.groups()]
+        seq, cycles, event, words = fields[0], fields[1], fields[2], fields[3:]
+
+        fmt = elf.string_at(event)
+        text = format_event(elf, fmt, words) if fmt is not None else '<unknown event 0x%x>' % event
+        delta = cycles - last_cycles if last_cycles is not None else 0
+        last_cycles = cycles
+        print('%8d %+12d  %s' % (seq, delta, text))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2015, Josef Mihalits
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *
+ */
+
+/*
+ * Binary event tracing.
+ *
+ * Trace an event with a printf style format and up to four arguments:
+ *
+ *   TRACE("key %s: vkey=%d", pressed ? "DOWN" : "UP", vkey);
+ *
+ * Instead of printing, TRACE stores a fixed size record (cycle count,
+ * event, four words) in a ring in memory, which takes tens of cycles where
+ * a printf to the polled serial port takes milliseconds. The format string
+ * is never looked at at run time: it is placed in the _trace_fmt section of
+ * the ELF file, and the record holds its address.
+ *
+ * The records are printed later, when it suits the app, as "TR&" lines of
+ * hex: trace_drain(n) prints at most n records that were not printed yet
+ * (call it where there is time to spare), trace_dump() prints all of them.
+ * apps/shared/trace-decode.py turns those lines back into text, with the
+ * format strings from the ELF file:
+ *
+ *   trace-decode.py images/keyboard4-image-ia32-pc99 console.log
+ *
+ * Arguments are stored as uintptr_t words. A %s argument must point to a
+ * constant string (a literal, or a table of them), which the decoder reads
+ * from the ELF file as well. A 64 bit value takes two words, low word
+ * first, and is printed with %llu or %llx.
+ *
+ * The ring keeps the last APP_SHARED_TRACE_ENTRIES records, older ones are
+ * overwritten and reported as lost by the next drain. Cycles come from
+ * pmu.h and read as zero unless APP_SHARED_PMU is set, the order of the
+ * records is always kept. The ring is not locked, so only trace from one
+ * thread.
+ *
+ * Unless APP_SHARED_TRACE is set, TRACE prints the format and a newline
+ * with printf, and draining does nothing.
+ */
+
+#ifndef __SHARED_TRACE_H
+#define __SHARED_TRACE_H
+
+#include <autoconf.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pmu.h"
+
+#define TRACE_MAX_ARGS 4
+
+#ifdef CONFIG_APP_SHARED_TRACE
+
+#define TRACE_ENTRIES CONFIG_APP_SHARED_TRACE_ENTRIES
+
+#if (TRACE_ENTRIES & (TRACE_ENTRIES - 1)) != 0
+#error "APP_SHARED_TRACE_ENTRIES must be a power of two"
+#endif
+
+typedef struct trace_record {
+    uint64_t cycles;
+    /* address of the format string in _trace_fmt */
+    uintptr_t event;
+    uintptr_t args[TRACE_MAX_ARGS];
+} trace_record_t;
+
+typedef struct trace_ring {
+    /* records ever written, and printed */
+    uint32_t head;
+    uint32_t drained;
+    trace_record_t records[TRACE_ENTRIES];
+} trace_ring_t;
+
+/* weak, so every file including this shares the one ring */
+trace_ring_t trace_ring __attribute__((weak));
+
+static inline void
+trace_emit(const char *event, uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3)
+{
+    trace_record_t *r = &trace_ring.records[trace_ring.head & (TRACE_ENTRIES - 1)];
+
+    r->cycles = pmu_cycles();
+    r->event = (uintptr_t) event;
+    r->args[0] = a0;
+    r->args[1] = a1;
+    r->args[2] = a2;
+    r->args[3] = a3;
+    trace_ring.head++;
+}
+
+/* pad the arguments to TRACE_MAX_ARGS words */
+#define _TRACE_W(x) ((uintptr_t) (x))
+#define _TRACE_ARGS0() 0, 0, 0, 0
+#define _TRACE_ARGS1(a) _TRACE_W(a), 0, 0, 0
+#define _TRACE_ARGS2(a, b) _TRACE_W(a), _TRACE_W(b), 0, 0
+#define _TRACE_ARGS3(a, b, c) _TRACE_W(a), _TRACE_W(b), _TRACE_W(c), 0
+#define _TRACE_ARGS4(a, b, c, d) _TRACE_W(a), _TRACE_W(b), _TRACE_W(c), _TRACE_W(d)
+#define _TRACE_PICK(_0, _1, _2, _3, _4, name, ...) name
+#define _TRACE_ARGS(...) _TRACE_PICK(_, ##__VA_ARGS__, _TRACE_ARGS4, _TRACE_ARGS3, \
+                                     _TRACE_ARGS2, _TRACE_ARGS1, _TRACE_ARGS0)(__VA_ARGS__)
+
+#define TRACE(fmt, ...) do { \
+        static const char _trace_event[] __attribute__((used, section("_trace_fmt"))) = fmt; \
+        trace_emit(_trace_event, _TRACE_ARGS(__VA_ARGS__)); \
+    } while (0)
+
+/* Print at most max records that have not been printed yet, oldest first */
+static inline void
+trace_drain(uint32_t max)
+{
+    uint32_t head = trace_ring.head;
+    uint32_t pending = head - trace_ring.drained;
+
+    if (pending > TRACE_ENTRIES) {
+        printf("TR& lost %u\n", pending - TRACE_ENTRIES);
+        trace_ring.drained = head - TRACE_ENTRIES;
+        pending = TRACE_ENTRIES;
+    }
+    if (pending > max) {
+        pending = max;
+    }
+
+    for (uint32_t i = 0; i < pending; i++) {
+        uint32_t seq = trace_ring.drained + i;
+        trace_record_t *r = &trace_ring.records[seq & (TRACE_ENTRIES - 1)];
+        printf("TR& %x %llx %lx %lx %lx %lx %lx\n", seq, (unsigned long long) r->cycles,
+               (unsigned long) r->event, (unsigned long) r->args[0], (unsigned long) r->args[1],
+               (unsigned long) r->args[2], (unsigned long) r->args[3]);
+    }
+    trace_ring.drained += pending;
+}
+
+/* Print every record that has not been printed yet */
+static inline void
+trace_dump(void)
+{
+    trace_drain(UINT32_MAX);
+}
+
+#else /* !CONFIG_APP_SHARED_TRACE */
+
+#define TRACE(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+
+static inline void
+trace_drain(uint32_t max)
+{
+}
+
+static inline void
+trace_dump(void)
+{
+}
+
+#endif /* CONFIG_APP_SHARED_TRACE */
+
+#endif /* __SHARED_TRACE_H */
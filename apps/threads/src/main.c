@@ -36,12 +36,20 @@
 #endif
 
 #include <utils/util.h>
+#include <utils/time.h>
 
 #include <vka/object.h>
 #include <vka/capops.h>
 
 #include <vspace/vspace.h>
 
+#ifdef CONFIG_APP_THREADS_PROFILE
+#include "profiler.h"
+#endif
+#ifdef CONFIG_APP_THREADS_MONITOR
+#include "monitor.h"
+#endif
+
 
 struct env {
     /* An initialized vka that may be used by the test. */
@@ -140,6 +148,78 @@ seL4_Word thread1stack[thread0SIZE];
 #define thread1stackend     (&thread1stack[thread0SIZE])
 
 
+#if defined(CONFIG_APP_THREADS_PROFILE) || defined(CONFIG_APP_THREADS_MONITOR)
+// The threads run below the profiler or monitor, so that the timer
+// interrupt lets it preempt them wherever they are.
+#define THREAD_PRIORITY 254
+#else
+#define THREAD_PRIORITY 255
+#endif
+
+
+#ifdef CONFIG_APP_THREADS_PROFILE
+static profiler_t profiler;
+
+/* Sample the instruction pointers of the threads from the timer
+ * interrupt, and print the histogram every
+ * APP_THREADS_PROFILE_SAMPLES samples. Never returns. */
+static void
+run_profiler(seL4_CPtr tcbs, int num)
+{
+    vka_object_t timer_aep;
+    seL4_timer_t *timer;
+    UNUSED int error;
+
+    error = vka_alloc_async_endpoint(&env.vka, &timer_aep);
+    assert(error == 0);
+    timer = sel4platsupport_get_default_timer(&env.vka, &env.vspace, &env.simple, timer_aep.cptr);
+    assert(timer != NULL);
+
+    profiler_init(&profiler);
+    for (int i = 0; i < num; i++) {
+        profiler_add_target(&profiler, tcbs + i);
+    }
+
+    printf("Profiling %d threads at %d Hz\n", num, CONFIG_APP_THREADS_PROFILE_HZ);
+    error = timer_periodic(timer->timer, NS_IN_S / CONFIG_APP_THREADS_PROFILE_HZ);
+    assert(error == 0);
+    timer_start(timer->timer);
+
+    for (;;) {
+        seL4_Wait(timer_aep.cptr, NULL);
+        profiler_sample(&profiler);
+        sel4_timer_handle_single_irq(timer);
+
+        if (profiler.samples == CONFIG_APP_THREADS_PROFILE_SAMPLES) {
+            // the serial port is slow, samples stop while printing
+            profiler_dump(&profiler);
+        }
+    }
+}
+#endif /* CONFIG_APP_THREADS_PROFILE */
+
+
+#ifdef CONFIG_APP_THREADS_MONITOR
+static monitor_t monitor;
+
+/* Watch the threads with the CPU monitor, which takes over from
+ * us: the root thread is suspended. */
+static void
+run_monitor(seL4_CPtr tcbs)
+{
+    UNUSED int error;
+
+    monitor_init(&monitor);
+    monitor_add(&monitor, "thread0", tcbs + 0, THREAD_PRIORITY);
+    monitor_add(&monitor, "thread1", tcbs + 1, THREAD_PRIORITY);
+    error = monitor_start(&monitor, &env.vka, &env.vspace, &env.simple, 255);
+    assert(error == 0);
+
+    seL4_TCB_Suspend(seL4_CapInitThreadTCB);
+}
+#endif /* CONFIG_APP_THREADS_MONITOR */
+
+
 
 void run_threads(seL4_BootInfo *info) {
 
@@ -183,7 +263,7 @@ void run_threads(seL4_BootInfo *info) {
   res = seL4_TCB_Configure(
       tcbs+0,
       0,                           // fault_ep
-      255,                         // priority
+      THREAD_PRIORITY,             // priority
       cnodeCap, seL4_NilData,      // cspace, data
       seL4_CapInitThreadVSpace, seL4_NilData, // vspace
       0, 0);                       // IPCBuffer
@@ -212,7 +292,7 @@ void run_threads(seL4_BootInfo *info) {
   res = seL4_TCB_Configure(
       tcbs+1,
       0,                           // fault_ep
-      255,                         // priority
+      THREAD_PRIORITY,             // priority
       cnodeCap, seL4_NilData,      // cspace, data
       seL4_CapInitThreadVSpace, seL4_NilData, // vspace
       0, 0);                       // IPCBuffer
@@ -242,7 +322,13 @@ void run_threads(seL4_BootInfo *info) {
   res = seL4_TCB_Resume(tcbs+1);
   printf("Resume 1 result: %x\n", res);
 
+#if defined(CONFIG_APP_THREADS_PROFILE)
+  run_profiler(tcbs, 2);
+#elif defined(CONFIG_APP_THREADS_MONITOR)
+  run_monitor(tcbs);
+#else
   for (;;);
+#endif
 
 }
 
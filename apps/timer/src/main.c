@@ -17,6 +17,7 @@
 #include <sel4platsupport/plat/timer.h> // time stuff
 #include <sel4utils/vspace.h>
 #include <utils/time.h> // time stuff
+#include <trace.h>
 #ifdef CONFIG_KERNEL_STABLE
 #include <simple-stable/simple-stable.h>
 #else
@@ -118,7 +119,12 @@ do_something()
         uint64_t tsc_time = timer_get_time(tsc_timer->timer);
         printf("time since start: %llu (s) \n", tsc_time / NS_IN_S);
     } else {
+#ifdef CONFIG_APP_SHARED_TRACE
+        // printing a dot takes longer than the interrupt; trace it instead
+        TRACE("tick %d", count);
+#else
         printf(".");
+#endif
     }
     fflush(stdout);
 }
@@ -188,6 +194,7 @@ test_interrupt()
         do_something();
     }
     printf("\n");
+    trace_dump();
 
     timer_stop(timer->timer);
     sel4_timer_handle_single_irq(timer);